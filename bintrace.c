@@ -0,0 +1,293 @@
+/* Binary command traces: streaming writer and memory-mapped reader */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bintrace.h"
+
+#define BT_OUTBUF_SIZE (1 << 16)
+#define BT_INIT_SLOTS 256
+
+static bool put_varint(FILE *out, uint64_t v)
+{
+    uint8_t buf[10];
+    int n = 0;
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v)
+            buf[n] |= 0x80;
+        n++;
+    } while (v);
+    return fwrite(buf, 1, n, out) == (size_t) n;
+}
+
+static bool get_varint(bt_reader_t *r, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && r->pos < r->size; shift += 7) {
+        uint8_t b = r->map[r->pos++];
+        result |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* FNV-1a */
+static uint32_t hash_string(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool writer_grow(bt_writer_t *w)
+{
+    size_t cap = w->cap ? w->cap * 2 : BT_INIT_SLOTS;
+    char **slots = calloc(cap, sizeof(char *));
+    uint32_t *ids = calloc(cap, sizeof(uint32_t));
+    if (!slots || !ids) {
+        free(slots);
+        free(ids);
+        return false;
+    }
+
+    for (size_t i = 0; i < w->cap; i++) {
+        if (!w->slots[i])
+            continue;
+        size_t j = hash_string(w->slots[i]) & (cap - 1);
+        while (slots[j])
+            j = (j + 1) & (cap - 1);
+        slots[j] = w->slots[i];
+        ids[j] = w->ids[i];
+    }
+    free(w->slots);
+    free(w->ids);
+    w->slots = slots;
+    w->ids = ids;
+    w->cap = cap;
+    return true;
+}
+
+bool bt_writer_open(bt_writer_t *w, const char *dst, uint64_t flags)
+{
+    memset(w, 0, sizeof(*w));
+    if (!writer_grow(w))
+        return false;
+
+    w->out = fopen(dst, "wb");
+    if (!w->out) {
+        free(w->slots);
+        free(w->ids);
+        return false;
+    }
+    setvbuf(w->out, NULL, _IOFBF, BT_OUTBUF_SIZE);
+
+    w->flags = flags;
+    fwrite(BT_MAGIC, 1, BT_MAGIC_LEN, w->out);
+    return put_varint(w->out, flags);
+}
+
+/* Write a reference to s, or the literal itself the first time it is seen */
+static bool writer_put_string(bt_writer_t *w, const char *s)
+{
+    size_t j = hash_string(s) & (w->cap - 1);
+    while (w->slots[j]) {
+        if (!strcmp(w->slots[j], s))
+            return put_varint(w->out, (uint64_t) w->ids[j] + 1);
+        j = (j + 1) & (w->cap - 1);
+    }
+
+    char *copy = strdup(s);
+    if (!copy)
+        return false;
+    w->slots[j] = copy;
+    w->ids[j] = w->strings++;
+
+    /* Keep the load factor below one half */
+    if (w->strings * 2 > w->cap && !writer_grow(w))
+        return false;
+
+    size_t len = strlen(s) + 1;
+    return put_varint(w->out, 0) && fwrite(s, 1, len, w->out) == len;
+}
+
+bool bt_writer_put(bt_writer_t *w, int argc, char *argv[])
+{
+    if (!put_varint(w->out, argc))
+        return false;
+    for (int i = 0; i < argc; i++) {
+        if (!writer_put_string(w, argv[i]))
+            return false;
+    }
+    return true;
+}
+
+bool bt_writer_put_timed(bt_writer_t *w,
+                         uint64_t ns,
+                         int argc,
+                         char *argv[])
+{
+    if (ns < w->stamp)
+        ns = w->stamp;
+    if (!put_varint(w->out, ns - w->stamp))
+        return false;
+    w->stamp = ns;
+    return bt_writer_put(w, argc, argv);
+}
+
+bool bt_writer_close(bt_writer_t *w)
+{
+    bool ok = !ferror(w->out);
+    ok = !fclose(w->out) && ok;
+
+    for (size_t i = 0; i < w->cap; i++)
+        free(w->slots[i]);
+    free(w->slots);
+    free(w->ids);
+    return ok;
+}
+
+bool bt_reader_open(bt_reader_t *r, const char *src)
+{
+    memset(r, 0, sizeof(*r));
+
+    int fd = open(src, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < BT_MAGIC_LEN) {
+        close(fd);
+        return false;
+    }
+
+    /* Read-only: bt_reader_next() hands out copies of the arguments */
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return false;
+    }
+    madvise(r->map, r->size, MADV_SEQUENTIAL);
+
+    r->pos = BT_MAGIC_LEN;
+    if (memcmp(r->map, BT_MAGIC, BT_MAGIC_LEN) ||
+        !get_varint(r, &r->flags) || (r->flags & ~(uint64_t) BT_FLAG_TIMED)) {
+        bt_reader_close(r);
+        return false;
+    }
+    return true;
+}
+
+static const char *reader_get_string(bt_reader_t *r, uint32_t *idp)
+{
+    uint64_t tag;
+    if (!get_varint(r, &tag))
+        return NULL;
+
+    if (tag) {
+        if (tag > r->nstrings)
+            return NULL;
+        *idp = tag - 1;
+        return r->strings[tag - 1];
+    }
+
+    const char *s = r->map + r->pos;
+    const char *end = memchr(s, '\0', r->size - r->pos);
+    if (!end)
+        return NULL;
+    r->pos += end - s + 1;
+
+    if (r->nstrings == r->strings_cap) {
+        size_t cap = r->strings_cap ? r->strings_cap * 2 : BT_INIT_SLOTS;
+        const char **strings = realloc(r->strings, cap * sizeof(char *));
+        if (!strings)
+            return NULL;
+        r->strings = strings;
+        r->strings_cap = cap;
+    }
+    *idp = r->nstrings;
+    r->strings[r->nstrings++] = s;
+    return s;
+}
+
+int bt_reader_next(bt_reader_t *r, char ***argvp, uint32_t *opp)
+{
+    if (r->pos == r->size)
+        return 0;
+
+    uint64_t delta;
+    if (r->flags & BT_FLAG_TIMED) {
+        if (!get_varint(r, &delta))
+            return -1;
+        r->stamp += delta;
+    }
+
+    uint64_t argc;
+    if (!get_varint(r, &argc) || !argc || argc > INT32_MAX)
+        return -1;
+
+    if (argc > r->argv_cap) {
+        char **argv = realloc(r->argv, argc * sizeof(char *));
+        if (!argv)
+            return -1;
+        r->argv = argv;
+        r->argv_cap = argc;
+    }
+
+    size_t len = 0;
+    for (uint64_t i = 0; i < argc; i++) {
+        uint32_t id = 0;
+        const char *s = reader_get_string(r, &id);
+        if (!s)
+            return -1;
+        if (!i)
+            *opp = id;
+        r->argv[i] = (char *) s;
+        len += strlen(s) + 1;
+    }
+
+    /* Commands may modify their arguments: hand out copies, which also
+     * lets the file stay mapped read-only
+     */
+    if (len > r->scratch_cap) {
+        char *scratch = realloc(r->scratch, len);
+        if (!scratch)
+            return -1;
+        r->scratch = scratch;
+        r->scratch_cap = len;
+    }
+    char *dst = r->scratch;
+    for (uint64_t i = 0; i < argc; i++) {
+        size_t n = strlen(r->argv[i]) + 1;
+        r->argv[i] = memcpy(dst, r->argv[i], n);
+        dst += n;
+    }
+
+    *argvp = r->argv;
+    return (int) argc;
+}
+
+void bt_reader_close(bt_reader_t *r)
+{
+    if (r->map)
+        munmap(r->map, r->size);
+    free(r->strings);
+    free(r->argv);
+    free(r->scratch);
+    memset(r, 0, sizeof(*r));
+}
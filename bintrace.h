@@ -0,0 +1,89 @@
+#ifndef LAB0_BINTRACE_H
+#define LAB0_BINTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Compact binary form of a command script.
+ *
+ *   file   := magic flags record*
+ *   magic  := "QTB1"
+ *   flags  := varint, BT_FLAG_TIMED or 0
+ *   record := [varint(delta)] varint(argc) arg{argc}
+ *   arg    := varint(0) bytes '\0'  new string, appended to the string table
+ *           | varint(id + 1)        reference to string table entry id
+ *
+ * Varints are unsigned LEB128.  The string table is built incrementally as
+ * literals appear, so a file can be written in a single streaming pass and
+ * read back from a read-only memory mapping: table entries point into it,
+ * and only the arguments of the record being replayed are copied out.
+ *
+ * Captured sessions are timed: every record starts with the nanoseconds
+ * elapsed since the previous one (since the capture started, for the first),
+ * so that replay can reproduce the original pacing.
+ */
+
+#define BT_MAGIC "QTB1"
+#define BT_MAGIC_LEN 4
+
+/* Records carry a timestamp delta */
+#define BT_FLAG_TIMED 1
+
+typedef struct {
+    FILE *out;
+    char **slots;   /* Interned strings, open addressing */
+    uint32_t *ids;  /* String table index of each slot */
+    size_t cap;     /* Number of slots, a power of 2 */
+    size_t strings; /* Number of strings in the table */
+    uint64_t flags;
+    uint64_t stamp; /* Time of the last timed record */
+} bt_writer_t;
+
+typedef struct {
+    char *map; /* Mapped read-only */
+    size_t size;
+    size_t pos;
+    const char **strings; /* String table, pointers into map */
+    size_t nstrings, strings_cap;
+    char **argv; /* Reused for every record */
+    size_t argv_cap;
+    char *scratch; /* Copies of the arguments of the current record */
+    size_t scratch_cap;
+    uint64_t flags;
+    uint64_t stamp; /* Time of the last record, 0 unless BT_FLAG_TIMED */
+} bt_reader_t;
+
+/* Create dst and write the file header; flags is BT_FLAG_TIMED or 0 */
+bool bt_writer_open(bt_writer_t *w, const char *dst, uint64_t flags);
+
+/* Append one command to an untimed trace */
+bool bt_writer_put(bt_writer_t *w, int argc, char *argv[]);
+
+/* Append one command issued ns nanoseconds after the capture started.
+ * Timestamps must not decrease.
+ */
+bool bt_writer_put_timed(bt_writer_t *w,
+                         uint64_t ns,
+                         int argc,
+                         char *argv[]);
+
+/* Flush and close; false if any write failed */
+bool bt_writer_close(bt_writer_t *w);
+
+/* Map src and check its header */
+bool bt_reader_open(bt_reader_t *r, const char *src);
+
+/* Decode the next command.  *argvp points to copies of its arguments, which
+ * the command may modify, and stays valid until the next call; *opp is the
+ * string table index of argv[0], which lets callers cache the command lookup.
+ * For timed traces, r->stamp is updated to the time the command was issued.
+ *
+ * Return: argc, 0 at end of file, -1 for malformed input
+ */
+int bt_reader_next(bt_reader_t *r, char ***argvp, uint32_t *opp);
+
+void bt_reader_close(bt_reader_t *r);
+
+#endif /* LAB0_BINTRACE_H */
@@ -1,25 +1,40 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "bintrace.h"
 #include "console.h"
+#include "profile.h"
 #include "report.h"
+#include "timeline.h"
 #include "web.h"
 
+/* Only the allocation counters are needed; keep regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
 /* Some global values */
 int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+/* Sorted view of cmd_list for binary search, rebuilt after add_cmd */
+static cmd_element_t **cmd_index = NULL;
+static int cmd_count = 0;
+static bool cmd_index_stale = true;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -29,6 +44,20 @@ static bool block_timing = false;
 /* Time of day */
 static double first_time, last_time;
 
+/* Optional functions that undo each run of "time -n" */
+static repeat_save_func_t repeat_save = NULL;
+static cmd_func_t repeat_restore = NULL;
+static cmd_func_t repeat_discard = NULL;
+
+/* Where "timeline" writes its spans, NULL while it is off */
+static char *timeline_file = NULL;
+
+/* Session capture, see do_capture() */
+static bt_writer_t capture;
+static bool capturing = false;
+static bool capture_paused = false; /* While "time -n" repeats a command */
+static uint64_t capture_start;
+
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
  */
@@ -53,6 +82,7 @@ static int fd_max = 0;
 static int err_limit = 5;
 static int err_cnt = 0;
 static int echo = 0;
+static int collect_stats = 0; /* Per-command latency percentiles */
 
 static bool quit_flag = false;
 static char *prompt = "cmd> ";
@@ -71,6 +101,9 @@ static bool push_file(char *fname);
 static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
+static void capture_cmd(cmd_element_t *cmd, int argc, char *argv[]);
+static bool capture_stop(void);
+static bool timeline_finish(void);
 
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
@@ -87,8 +120,13 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    memset(&cmd->metrics, 0, sizeof(cmd->metrics));
+    cmd->hdr = collect_stats
+                   ? calloc_or_fail(1, sizeof(metrics_hdr_t), "add_cmd")
+                   : NULL;
     cmd->next = next_cmd;
     *last_loc = cmd;
+    cmd_index_stale = true;
 }
 
 /* Add a new parameter */
@@ -111,53 +149,70 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     *last_loc = param;
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Reused storage for parsed command lines */
+typedef struct {
+    char *buf;
+    size_t buf_size;
+    char **argv;
+    int argv_size;
+} arg_arena_t;
+
+static arg_arena_t cmd_args;
+
+static void arena_free(arg_arena_t *a)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
+    if (a->buf)
+        free_block(a->buf, a->buf_size);
+    if (a->argv)
+        free_array(a->argv, a->argv_size, sizeof(char *));
+    memset(a, 0, sizeof(*a));
+}
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
+/* Parse a string into a command line.
+ * The words are copied into the arena with each one null-terminated, and
+ * argv points into it, so the result stays valid until the arena is used
+ * again.  Nothing is allocated once the arena has grown to fit.
+ */
+static char **parse_args(arg_arena_t *a, const char *line, int *argcp)
+{
+    size_t len = strlen(line);
+    if (len + 1 > a->buf_size) {
+        if (a->buf)
+            free_block(a->buf, a->buf_size);
+        a->buf_size = len + 1 > 256 ? len + 1 : 256;
+        a->buf = malloc_or_fail(a->buf_size, "parse_args");
+    }
 
-    char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
+    const char *src = line;
+    char *dst = a->buf;
     int argc = 0;
+    int c;
     while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
+        if (isspace(c))
+            continue;
+
+        /* Hit start of new word */
+        if (argc == a->argv_size) {
+            int size = a->argv_size ? a->argv_size * 2 : 16;
+            char **argv = calloc_or_fail(size, sizeof(char *), "parse_args");
+            if (a->argv) {
+                memcpy(argv, a->argv, a->argv_size * sizeof(char *));
+                free_array(a->argv, a->argv_size, sizeof(char *));
             }
+            a->argv = argv;
+            a->argv_size = size;
+        }
+        a->argv[argc++] = dst;
+        *dst++ = c;
+        while ((c = *src) != '\0' && !isspace(c)) {
             *dst++ = c;
+            src++;
         }
-    }
-    /* Let the last substring is null-terminated */
-    *dst++ = '\0';
-
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+        *dst++ = '\0';
     }
 
-    free_block(buf, len + 1);
     *argcp = argc;
-    return argv;
+    return a->argv;
 }
 
 /* Handles forced console termination for record_error and do_quit */
@@ -168,8 +223,16 @@ static bool force_quit(int argc, char *argv[])
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
+        if (ele->hdr)
+            free_block(ele->hdr, sizeof(metrics_hdr_t));
         free_block(ele, sizeof(cmd_element_t));
     }
+    cmd_list = NULL;
+    if (cmd_index)
+        free_array(cmd_index, cmd_count, sizeof(cmd_element_t *));
+    cmd_index = NULL;
+    cmd_count = 0;
+    cmd_index_stale = true;
 
     param_element_t *p = param_list;
     while (p) {
@@ -180,10 +243,15 @@ static bool force_quit(int argc, char *argv[])
 
     while (buf_stack)
         pop_file();
+    capture_stop();
+    timeline_finish();
+    if (profile_running())
+        profile_stop(NULL, NULL, NULL);
 
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
+    arena_free(&cmd_args);
 
     quit_flag = true;
     return ok;
@@ -200,29 +268,81 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+static void build_cmd_index()
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
-    bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
-    if (next_cmd) {
-        ok = next_cmd->operation(argc, argv);
-        if (!ok)
-            record_error();
-    } else {
+    if (cmd_index)
+        free_array(cmd_index, cmd_count, sizeof(cmd_element_t *));
+
+    cmd_count = 0;
+    for (cmd_element_t *c = cmd_list; c; c = c->next)
+        cmd_count++;
+
+    /* cmd_list is kept in name order, so the index comes out sorted */
+    cmd_index = calloc_or_fail(cmd_count, sizeof(cmd_element_t *),
+                               "build_cmd_index");
+    int i = 0;
+    for (cmd_element_t *c = cmd_list; c; c = c->next)
+        cmd_index[i++] = c;
+    cmd_index_stale = false;
+}
+
+/* Look up a command by name */
+static cmd_element_t *find_cmd(const char *name)
+{
+    if (cmd_index_stale)
+        build_cmd_index();
+
+    int lo = 0, hi = cmd_count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int r = strcmp(name, cmd_index[mid]->name);
+        if (!r)
+            return cmd_index[mid];
+        if (r < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+/* Run a command that has already been looked up; NULL means unknown */
+static bool dispatch_cmd(cmd_element_t *cmd, int argc, char *argv[])
+{
+    if (!cmd) {
         report(1, "Unknown command '%s'", argv[0]);
         record_error();
-        ok = false;
+        return false;
     }
 
+    if (capturing && !capture_paused)
+        capture_cmd(cmd, argc, argv);
+    /* One pair of clock reads feeds the counters, the percentiles and the
+     * timeline alike
+     */
+    uint64_t start = metrics_now_ns();
+    bool ok = cmd->operation(argc, argv);
+    uint64_t end = metrics_now_ns();
+    /* Command list is gone once the command has forced quitting */
+    if (!quit_flag) {
+        metrics_observe(&cmd->metrics, end - start, ok);
+        if (collect_stats)
+            metrics_hdr_record(cmd->hdr, end - start);
+        timeline_end_at(cmd->name, start, end);
+    }
+    if (!ok)
+        record_error();
     return ok;
 }
 
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    return dispatch_cmd(find_cmd(argv[0]), argc, argv);
+}
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
@@ -230,11 +350,9 @@ static bool interpret_cmd(char *cmdline)
         return false;
 
     int argc;
-    char **argv = parse_args(cmdline, &argc);
+    char **argv = parse_args(&cmd_args, cmdline, &argc);
     bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
+    report_flush();
 
     return ok;
 }
@@ -248,6 +366,15 @@ void add_quit_helper(cmd_func_t qf)
         report_event(MSG_FATAL, "Exceeded limit on quit helpers");
 }
 
+void set_repeat_hooks(repeat_save_func_t save,
+                      cmd_func_t restore,
+                      cmd_func_t discard)
+{
+    repeat_save = save;
+    repeat_restore = restore;
+    repeat_discard = discard;
+}
+
 /* Turn echoing on/off */
 void set_echo(bool on)
 {
@@ -367,6 +494,221 @@ static bool do_source(int argc, char *argv[])
     return true;
 }
 
+static bool do_convert(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "Use 'convert <src> <dst>'");
+        return false;
+    }
+
+    FILE *src = fopen(argv[1], "r");
+    if (!src) {
+        report(1, "Could not open source file '%s'", argv[1]);
+        return false;
+    }
+
+    bt_writer_t w;
+    if (!bt_writer_open(&w, argv[2], 0)) {
+        report(1, "Could not create trace file '%s'", argv[2]);
+        fclose(src);
+        return false;
+    }
+
+    /* argv of this command lives in cmd_args, so use a separate arena */
+    arg_arena_t args = {0};
+    bool ok = true;
+    char *line = NULL;
+    size_t cap = 0;
+    size_t count = 0;
+    while (ok && getline(&line, &cap, src) != -1) {
+        int cargc;
+        char **cargv = parse_args(&args, line, &cargc);
+        if (cargc) {
+            ok = bt_writer_put(&w, cargc, cargv);
+            count++;
+        }
+    }
+    arena_free(&args);
+    free(line);
+    fclose(src);
+
+    ok = bt_writer_close(&w) && ok;
+    if (!ok) {
+        report(1, "Error writing trace file '%s'", argv[2]);
+        return false;
+    }
+    report(1, "Converted %zu commands", count);
+    return true;
+}
+
+/* Cached command lookups, indexed by the string id of the command name,
+ * and the latency of every dispatch of the command
+ */
+typedef struct {
+    cmd_element_t *cmd;
+    bool resolved;
+    uint64_t *lat;
+    size_t count, cap;
+} replay_op_t;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Value below which a share p of the sorted samples lie */
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t i = (size_t) (p * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+static void replay_report(replay_op_t *ops, size_t nops, uint64_t elapsed)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < nops; i++)
+        total += ops[i].count;
+    report(1, "Replayed %zu commands in %.3f s, %.0f commands/s", total,
+           elapsed * 1e-9, elapsed ? total * 1e9 / elapsed : 0.0);
+    if (!total)
+        return;
+
+    report(1, "%-12s %10s %10s %10s %10s %10s", "command", "count", "p50 us",
+           "p90 us", "p99 us", "max us");
+    for (size_t i = 0; i < nops; i++) {
+        replay_op_t *op = &ops[i];
+        if (!op->count)
+            continue;
+        qsort(op->lat, op->count, sizeof(uint64_t), cmp_u64);
+        report(1, "%-12s %10zu %10.1f %10.1f %10.1f %10.1f",
+               op->cmd ? op->cmd->name : "?", op->count,
+               percentile(op->lat, op->count, 0.5) * 1e-3,
+               percentile(op->lat, op->count, 0.9) * 1e-3,
+               percentile(op->lat, op->count, 0.99) * 1e-3,
+               op->lat[op->count - 1] * 1e-3);
+    }
+}
+
+/* Sleep until ns on the CLOCK_MONOTONIC time line of metrics_now_ns().  Any
+ * error but an interruption would recur, so the replay just runs late.
+ */
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000UL,
+        .tv_nsec = ns % 1000000000UL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static bool do_replay(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        report(1, "No trace file given. Use 'replay <file> [speed]'.");
+        return false;
+    }
+
+    /* 1 replays at the original pace, 2 twice as fast, 0 without waiting */
+    double speed = 0;
+    if (argc == 3) {
+        char *end;
+        speed = strtod(argv[2], &end);
+        if (*end || !(speed >= 0)) {
+            report(1, "Invalid speed '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    bt_reader_t r;
+    if (!bt_reader_open(&r, argv[1])) {
+        report(1, "Could not open trace file '%s'", argv[1]);
+        return false;
+    }
+    if (speed > 0 && !(r.flags & BT_FLAG_TIMED)) {
+        report(1, "Trace file '%s' has no timing; replaying without pacing",
+               argv[1]);
+        speed = 0;
+    }
+
+    replay_op_t *ops = NULL;
+    size_t nops = 0;
+    bool ok = true;
+    char **rargv;
+    uint32_t op;
+    int rargc = 0;
+    uint64_t lag = 0;
+    uint64_t start = metrics_now_ns();
+    while (!quit_flag && (rargc = bt_reader_next(&r, &rargv, &op)) > 0) {
+        if (op >= nops) {
+            size_t n = nops ? nops : 16;
+            while (n <= op)
+                n *= 2;
+            replay_op_t *tmp = realloc(ops, n * sizeof(replay_op_t));
+            if (!tmp) {
+                rargc = -1;
+                break;
+            }
+            memset(tmp + nops, 0, (n - nops) * sizeof(replay_op_t));
+            ops = tmp;
+            nops = n;
+        }
+        replay_op_t *o = &ops[op];
+        if (!o->resolved) {
+            o->cmd = find_cmd(rargv[0]);
+            o->resolved = true;
+        }
+        if (o->count == o->cap) {
+            size_t cap = o->cap ? o->cap * 2 : 64;
+            uint64_t *tmp = realloc(o->lat, cap * sizeof(uint64_t));
+            if (!tmp) {
+                rargc = -1;
+                break;
+            }
+            o->lat = tmp;
+            o->cap = cap;
+        }
+
+        if (speed > 0) {
+            uint64_t due = start + (uint64_t) (r.stamp / speed);
+            uint64_t now = metrics_now_ns();
+            if (now < due)
+                sleep_until(due);
+            else if (now - due > lag)
+                lag = now - due;
+        }
+
+        if (echo) {
+            report_noreturn(1, prompt);
+            for (int i = 0; i < rargc; i++)
+                report_noreturn(1, i ? " %s" : "%s", rargv[i]);
+            report_noreturn(1, "\n");
+        }
+        uint64_t t = metrics_now_ns();
+        dispatch_cmd(o->cmd, rargc, rargv);
+        o->lat[o->count++] = metrics_now_ns() - t;
+        report_flush();
+    }
+    if (rargc < 0) {
+        report(1, "Malformed trace file '%s'", argv[1]);
+        ok = false;
+    }
+
+    /* A replayed quit has already torn down the command list */
+    if (!quit_flag) {
+        replay_report(ops, nops, metrics_now_ns() - start);
+        if (speed > 0)
+            report(1, "Fell behind schedule by up to %.3f ms", lag * 1e-6);
+    }
+
+    for (size_t i = 0; i < nops; i++)
+        free(ops[i].lat);
+    free(ops);
+    bt_reader_close(&r);
+    return ok;
+}
+
 static bool do_log(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -382,8 +724,77 @@ static bool do_log(int argc, char *argv[])
     return result;
 }
 
+/* Run a command warmup + reps times and summarize the timed runs */
+static bool time_repeat(int reps, int warmup, int argc, char *argv[])
+{
+    cmd_element_t *cmd = find_cmd(argv[0]);
+    if (!cmd) {
+        report(1, "Unknown command '%s'", argv[0]);
+        return false;
+    }
+
+    uint64_t *ns = malloc_or_fail(reps * sizeof(uint64_t), "time");
+    bool undo = repeat_save && repeat_save(argc, argv);
+    bool ok = true, paused = capture_paused;
+    int done = 0;
+    /* The capture holds the time command itself, which replays the runs */
+    capture_paused = true;
+    for (int r = -warmup; ok && !quit_flag && r < reps; r++) {
+        uint64_t start = metrics_now_ns();
+        ok = dispatch_cmd(cmd, argc, argv);
+        uint64_t t = metrics_now_ns() - start;
+        if (r >= 0)
+            ns[done++] = t;
+        /* Later runs would time a different queue */
+        if (undo && !quit_flag && !repeat_restore(argc, argv))
+            ok = false;
+    }
+    capture_paused = paused;
+    if (undo && !quit_flag)
+        repeat_discard(argc, argv);
+
+    if (done) {
+        qsort(ns, done, sizeof(uint64_t), cmp_u64);
+        double mean = 0, var = 0;
+        for (int i = 0; i < done; i++)
+            mean += ns[i];
+        mean /= done;
+        for (int i = 0; i < done; i++)
+            var += (ns[i] - mean) * (ns[i] - mean);
+        var = done > 1 ? var / (done - 1) : 0;
+        report(1,
+               "%d runs: min %" PRIu64 " ns, median %" PRIu64
+               " ns, mean %.0f ns, stddev %.0f ns, p99 %" PRIu64
+               " ns, %.0f ops/s",
+               done, ns[0], percentile(ns, done, 0.5), mean, sqrt(var),
+               percentile(ns, done, 0.99), mean > 0 ? 1e9 / mean : 0.0);
+    }
+    free_block(ns, reps * sizeof(uint64_t));
+    return ok;
+}
+
 static bool do_time(int argc, char *argv[])
 {
+    int reps = 0, warmup = 0;
+    int i = 1;
+    while (i + 1 < argc && argv[i][0] == '-') {
+        int *valp = !strcmp(argv[i], "-n")   ? &reps
+                    : !strcmp(argv[i], "-w") ? &warmup
+                                             : NULL;
+        if (!valp || !get_int(argv[i + 1], valp) || *valp < 0) {
+            report(1, "Use 'time [-n reps [-w warmup]] cmd arg ...'");
+            return false;
+        }
+        i += 2;
+    }
+    if (i > 1) {
+        if (reps < 1 || i == argc) {
+            report(1, "Use 'time [-n reps [-w warmup]] cmd arg ...'");
+            return false;
+        }
+        return time_repeat(reps, warmup, argc - i, argv + i);
+    }
+
     double delta = delta_time(&last_time);
     bool ok = true;
     if (argc <= 1) {
@@ -402,9 +813,265 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+static bool do_capture(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "Use 'capture <file>' to start, 'capture off' to stop");
+        return false;
+    }
+
+    if (!strcmp(argv[1], "off")) {
+        if (!capturing) {
+            report(1, "Not capturing");
+            return false;
+        }
+        return capture_stop();
+    }
+
+    if (capturing && !capture_stop())
+        return false;
+    if (!bt_writer_open(&capture, argv[1], BT_FLAG_TIMED)) {
+        report(1, "Could not create trace file '%s'", argv[1]);
+        return false;
+    }
+    capturing = true;
+    capture_start = metrics_now_ns();
+    return true;
+}
+
+/* Commands that only drive other commands are left out of the capture; the
+ * commands they issue are recorded instead.  "time -n" is the exception: it
+ * is recorded, and time_repeat() keeps its runs out.  Quit is left out too,
+ * since it would cut a replay short before it could report.
+ */
+static void capture_cmd(cmd_element_t *cmd, int argc, char *argv[])
+{
+    bool repeat = argc > 1 && argv[1][0] == '-';
+    if (cmd->operation == do_capture || cmd->operation == do_source ||
+        cmd->operation == do_replay ||
+        (cmd->operation == do_time && !repeat) || cmd->operation == do_quit)
+        return;
+
+    /* Record before running: commands may modify their arguments */
+    if (!bt_writer_put_timed(&capture, metrics_now_ns() - capture_start, argc,
+                             argv)) {
+        report(1, "Error writing capture file; capture stopped");
+        capture_stop();
+    }
+}
+
+/* Close the capture file, if any; false if writing it failed */
+static bool capture_stop(void)
+{
+    if (!capturing)
+        return true;
+    capturing = false;
+    if (!bt_writer_close(&capture)) {
+        report(1, "Error writing capture file");
+        return false;
+    }
+    return true;
+}
+
+/* Per-command latency histograms are only kept while the stats option is
+ * set, by "option stats 1" or "stats on", which leaves dispatch with a
+ * single test otherwise.
+ */
+static void stats_update(int oldval)
+{
+    if (!!collect_stats == !!oldval)
+        return;
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        if (collect_stats) {
+            c->hdr = calloc_or_fail(1, sizeof(metrics_hdr_t), "stats");
+        } else {
+            free_block(c->hdr, sizeof(metrics_hdr_t));
+            c->hdr = NULL;
+        }
+    }
+}
+
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "Use 'stats [on|off|reset]'");
+        return false;
+    }
+
+    if (argc == 2) {
+        bool on = !strcmp(argv[1], "on"), off = !strcmp(argv[1], "off");
+        bool reset = !strcmp(argv[1], "reset");
+        if (!on && !off && !reset) {
+            report(1, "Unknown stats action '%s'", argv[1]);
+            return false;
+        }
+        if (reset) {
+            for (cmd_element_t *c = cmd_list; c; c = c->next) {
+                if (c->hdr)
+                    memset(c->hdr, 0, sizeof(metrics_hdr_t));
+            }
+        } else {
+            int oldval = collect_stats;
+            collect_stats = on;
+            stats_update(oldval);
+        }
+        return true;
+    }
+
+    if (!collect_stats) {
+        report(1, "Latency statistics are off.  Use 'stats on'.");
+        return true;
+    }
+    report(1, "%-12s %10s %10s %10s %10s %10s %12s", "command", "count",
+           "p50 us", "p90 us", "p99 us", "max us", "ops/s");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        const metrics_hdr_t *h = c->hdr;
+        if (!h->count)
+            continue;
+        report(1, "%-12s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %12.0f",
+               c->name, h->count, metrics_hdr_percentile(h, 0.5) * 1e-3,
+               metrics_hdr_percentile(h, 0.9) * 1e-3,
+               metrics_hdr_percentile(h, 0.99) * 1e-3, h->max * 1e-3,
+               h->sum ? h->count * 1e9 / h->sum : 0.0);
+    }
+    return true;
+}
+
+static bool do_timeline(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "Use 'timeline <file>' to start, 'timeline off' to write");
+        return false;
+    }
+
+    if (!strcmp(argv[1], "off")) {
+        if (!timeline_file) {
+            report(1, "Timeline is not recording");
+            return false;
+        }
+        return timeline_finish();
+    }
+
+    if (!timeline_finish())
+        return false;
+    timeline_file = strdup(argv[1]);
+    if (!timeline_file) {
+        report(1, "Out of memory");
+        return false;
+    }
+    timeline_thread_name("main");
+    timeline_start();
+    return true;
+}
+
+/* Write the timeline, if recording; false if the file could not be written */
+static bool timeline_finish(void)
+{
+    if (!timeline_file)
+        return true;
+    bool ok = timeline_stop(timeline_file);
+    if (!ok)
+        report(1, "Could not write timeline file '%s'", timeline_file);
+    free(timeline_file);
+    timeline_file = NULL;
+    return ok;
+}
+
+static bool do_profile(int argc, char *argv[])
+{
+    if (argc >= 2 && argc <= 3 && !strcmp(argv[1], "start")) {
+        int hz = PROFILE_HZ;
+        if (argc == 3 && (!get_int(argv[2], &hz) || hz < 1 || hz > 100000)) {
+            report(1, "Invalid sampling rate '%s'", argv[2]);
+            return false;
+        }
+        if (profile_running()) {
+            report(1, "Profiler is already running");
+            return false;
+        }
+        if (!profile_start(hz)) {
+            report(1, "Could not start profiler");
+            return false;
+        }
+        return true;
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "stop")) {
+        if (!profile_running()) {
+            report(1, "Profiler is not running");
+            return false;
+        }
+        long samples, dropped;
+        if (!profile_stop(argv[2], &samples, &dropped)) {
+            report(1, "Could not write profile file '%s'", argv[2]);
+            return false;
+        }
+        report(1, "Wrote %ld samples to '%s'", samples, argv[2]);
+        if (dropped)
+            report(1, "Warning: %ld samples did not fit the buffer", dropped);
+        return true;
+    }
+
+    report(1, "Use 'profile start [hz]' and 'profile stop <file>'");
+    return false;
+}
+
 static bool use_linenoise = true;
 static int web_fd;
 
+/* Serve GET /metrics: per-command counters and latencies, memory gauges */
+static void web_metrics(int fd)
+{
+    int dupfd = dup(fd);
+    FILE *out = dupfd < 0 ? NULL : fdopen(dupfd, "w");
+    if (!out) {
+        if (dupfd >= 0)
+            close(dupfd);
+        return;
+    }
+
+    metrics_write_family(out, "qtest_commands_total", "counter",
+                         "Number of dispatched commands");
+    for (cmd_element_t *c = cmd_list; c; c = c->next)
+        fprintf(out, "qtest_commands_total{cmd=\"%s\"} %" PRIu64 "\n",
+                c->name, c->metrics.count);
+
+    metrics_write_family(out, "qtest_command_errors_total", "counter",
+                         "Number of commands that reported failure");
+    for (cmd_element_t *c = cmd_list; c; c = c->next)
+        fprintf(out, "qtest_command_errors_total{cmd=\"%s\"} %" PRIu64 "\n",
+                c->name, c->metrics.errors);
+
+    metrics_write_family(out, "qtest_command_duration_seconds", "histogram",
+                         "Command execution latency");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        if (c->metrics.count)
+            metrics_write_hist(out, "qtest_command_duration_seconds", "cmd",
+                               c->name, &c->metrics);
+    }
+
+    mem_usage_t usage;
+    get_mem_usage(&usage);
+    metrics_write_value(out, "qtest_console_allocations_total", "counter",
+                        "Blocks allocated by the interpreter",
+                        usage.allocate_cnt);
+    metrics_write_value(out, "qtest_console_allocated_bytes_total", "counter",
+                        "Bytes allocated by the interpreter",
+                        usage.allocate_bytes);
+    metrics_write_value(out, "qtest_console_frees_total", "counter",
+                        "Blocks freed by the interpreter", usage.free_cnt);
+    metrics_write_value(out, "qtest_console_bytes", "gauge",
+                        "Bytes currently held by the interpreter",
+                        usage.current_bytes);
+    metrics_write_value(out, "qtest_console_peak_bytes", "gauge",
+                        "Peak bytes held by the interpreter", usage.peak_bytes);
+    metrics_write_value(out, "qtest_queue_blocks", "gauge",
+                        "Blocks currently allocated through the test harness",
+                        allocation_check());
+
+    fclose(out);
+}
+
 static bool do_web(int argc, char *argv[])
 {
     int port = 9999;
@@ -417,6 +1084,7 @@ static bool do_web(int argc, char *argv[])
     if (web_fd > 0) {
         printf("listen on port %d, fd is %d\n", port, web_fd);
         line_set_eventmux_callback(web_eventmux);
+        web_set_metrics(web_metrics);
         use_linenoise = false;
     } else {
         perror("ERROR");
@@ -438,16 +1106,40 @@ void init_cmd()
                 "Display or set options. See 'Options' section for details",
                 "[name val]");
     ADD_COMMAND(quit, "Exit program", "");
+    ADD_COMMAND(profile,
+                "Sample CPU usage, written as folded stacks for flame graphs "
+                "on stop",
+                "start [hz]|stop file");
     ADD_COMMAND(source, "Read commands from source file", "file");
+    ADD_COMMAND(convert, "Convert command file to binary trace", "src dst");
+    ADD_COMMAND(replay, "Replay binary trace file, paced by speed if timed",
+                "file [speed]");
+    ADD_COMMAND(capture, "Record commands with timestamps to binary trace",
+                "file|off");
     ADD_COMMAND(log, "Copy output to file", "file");
-    ADD_COMMAND(time, "Time command execution", "cmd arg ...");
+    ADD_COMMAND(time,
+                "Time command execution, or its distribution over reps runs "
+                "after warmup untimed ones",
+                "[-n reps [-w warmup]] cmd arg ...");
+    ADD_COMMAND(stats, "Show or collect per-command latency percentiles",
+                "[on|off|reset]");
+    ADD_COMMAND(timeline,
+                "Record command and queue operation spans, written as Chrome "
+                "trace JSON on 'timeline off' or quit",
+                "file|off");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
+    add_param("asynclog", &log_async,
+              "Write log from a background thread (2: with fdatasync)",
+              log_async_update);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("stats", &collect_stats,
+              "Collect per-command latency percentiles for 'stats'",
+              stats_update);
 
     init_in();
     init_time(&last_time);
@@ -5,6 +5,7 @@
 #include <sys/select.h>
 
 #include "linenoise.h"
+#include "metrics.h"
 
 #define HISTORY_FILE ".cmd_history"
 
@@ -24,6 +25,8 @@ typedef struct __cmd_element {
     cmd_func_t operation;
     char *summary;
     char *param;
+    metrics_hist_t metrics; /* Dispatch count and latency */
+    metrics_hdr_t *hdr;     /* Fine-grained latency, NULL unless stats set */
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -56,6 +59,17 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Optional functions that let "time -n" run a command on the same state
+ * every time.  save is called before the first run with the command, and
+ * returns whether it needs undoing; if so, restore is called after every
+ * run and discard after the last one.  A restore that fails reports why and
+ * returns false, which stops the runs.
+ */
+typedef bool (*repeat_save_func_t)(int argc, char *argv[]);
+void set_repeat_hooks(repeat_save_func_t save,
+                      cmd_func_t restore,
+                      cmd_func_t discard);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
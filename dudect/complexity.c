@@ -0,0 +1,371 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "complexity.h"
+#include "cpucycles.h"
+#include "queue.h"
+#include "random.h"
+
+#define STR_LEN 7
+
+/* Fixture queues, built before and released after each timed run */
+static struct list_head *q, *q2;
+static queue_contex_t ctx[2];
+static LIST_HEAD(chain);
+
+static prng_t prng;
+static bool prng_seeded = false;
+static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+static bool fill_random(struct list_head *head, size_t n)
+{
+    char s[STR_LEN + 1] = {0};
+    for (size_t i = 0; i < n; i++) {
+        prng_fill_string(&prng, s, STR_LEN, charset, sizeof(charset) - 1);
+        if (!q_insert_tail(head, s))
+            return false;
+    }
+    return true;
+}
+
+/* Ascending: first, first + step, ... each value repeated dup times */
+static bool fill_sorted(struct list_head *head,
+                        size_t n,
+                        size_t first,
+                        size_t step,
+                        size_t dup)
+{
+    char s[24];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(s, sizeof(s), "%012zu", first + i / dup * step);
+        if (!q_insert_tail(head, s))
+            return false;
+    }
+    return true;
+}
+
+static bool setup_random(size_t n)
+{
+    q = q_new();
+    return q && fill_random(q, n);
+}
+
+static bool setup_dups(size_t n)
+{
+    q = q_new();
+    return q && fill_sorted(q, n, 0, 1, 2);
+}
+
+/* Two sorted queues of n / 2 elements each, which interleave */
+static bool setup_merge(size_t n)
+{
+    q = q_new();
+    q2 = q_new();
+    if (!q || !q2 || !fill_sorted(q, n / 2, 0, 2, 1) ||
+        !fill_sorted(q2, n - n / 2, 1, 2, 1))
+        return false;
+
+    INIT_LIST_HEAD(&chain);
+    ctx[0].q = q;
+    ctx[1].q = q2;
+    for (int i = 0; i < 2; i++) {
+        ctx[i].id = i;
+        ctx[i].size = q_size(ctx[i].q);
+        list_add_tail(&ctx[i].chain, &chain);
+    }
+    return true;
+}
+
+static void teardown(void)
+{
+    q_free(q);
+    q_free(q2);
+    q = q2 = NULL;
+}
+
+static void run_size(void)
+{
+    q_size(q);
+}
+
+static void run_insert_head(void)
+{
+    q_insert_head(q, "dudect");
+}
+
+static void run_insert_tail(void)
+{
+    q_insert_tail(q, "dudect");
+}
+
+static void run_remove_head(void)
+{
+    element_t *e = q_remove_head(q, NULL, 0);
+    if (e)
+        q_release_element(e);
+}
+
+static void run_remove_tail(void)
+{
+    element_t *e = q_remove_tail(q, NULL, 0);
+    if (e)
+        q_release_element(e);
+}
+
+static void run_delete_mid(void)
+{
+    q_delete_mid(q);
+}
+
+static void run_reverse(void)
+{
+    q_reverse(q);
+}
+
+static void run_reverseK(void)
+{
+    q_reverseK(q, 3);
+}
+
+static void run_swap(void)
+{
+    q_swap(q);
+}
+
+static void run_sort(void)
+{
+    q_sort(q, false);
+}
+
+static void run_dedup(void)
+{
+    q_delete_dup(q);
+}
+
+static void run_ascend(void)
+{
+    q_ascend(q);
+}
+
+static void run_descend(void)
+{
+    q_descend(q);
+}
+
+static void run_merge(void)
+{
+    q_merge(&chain, false);
+}
+
+/* Operations on one or two nodes are timed over several calls, which
+ * averages out the few cache misses that otherwise dominate a single call.
+ * Fewer than CX_MIN_N, so that removals never empty the queue.
+ */
+#define POINT_CALLS 8
+
+static const struct {
+    const char *name;
+    bool (*setup)(size_t n);
+    void (*run)(void);
+    int calls;
+} ops[] = {
+    {"size", setup_random, run_size, POINT_CALLS},
+    {"ih", setup_random, run_insert_head, POINT_CALLS},
+    {"it", setup_random, run_insert_tail, POINT_CALLS},
+    {"rh", setup_random, run_remove_head, POINT_CALLS},
+    {"rt", setup_random, run_remove_tail, POINT_CALLS},
+    {"dm", setup_random, run_delete_mid, POINT_CALLS},
+    {"reverse", setup_random, run_reverse, 1},
+    {"reverseK", setup_random, run_reverseK, 1},
+    {"swap", setup_random, run_swap, 1},
+    {"sort", setup_random, run_sort, 1},
+    {"dedup", setup_dups, run_dedup, 1},
+    {"ascend", setup_random, run_ascend, 1},
+    {"descend", setup_random, run_descend, 1},
+    {"merge", setup_merge, run_merge, 1},
+};
+
+#define N_OPS (sizeof(ops) / sizeof(ops[0]))
+
+const char *cx_op_name(size_t i)
+{
+    return i < N_OPS ? ops[i].name : NULL;
+}
+
+static const char *const model_names[] = {
+#define _(x, name) name,
+    CX_MODELS
+#undef _
+};
+
+static const char *const model_keys[] = {
+#define _(x, name) #x,
+    CX_MODELS
+#undef _
+};
+
+const char *cx_model_name(int model)
+{
+    return model >= 0 && model < CX_NMODELS ? model_names[model] : "?";
+}
+
+int cx_model_parse(const char *name)
+{
+    for (int i = 0; i < CX_NMODELS; i++) {
+        if (!strcmp(name, model_keys[i]))
+            return i;
+    }
+    return -1;
+}
+
+static double model_f(int model, double n)
+{
+    switch (model) {
+    case CX_logn:
+        return log2(n);
+    case CX_n:
+        return n;
+    case CX_nlogn:
+        return n * log2(n);
+    case CX_n2:
+        return n * n;
+    default:
+        return 1;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Read a buffer larger than the private caches, so that every timed run
+ * starts with the fixture in the shared cache.  Warm runs would instead find
+ * small queues in L1 and larger ones in L2, and the step in cost per node as
+ * the queue outgrows a level reads as an extra log factor.
+ */
+static void evict(void)
+{
+    static volatile uint8_t buf[CX_EVICT_SIZE];
+    for (size_t i = 0; i < CX_EVICT_SIZE; i += 64)
+        buf[i]++;
+}
+
+/* Weighted residual sum of squares of the best fit of y = a + b * f(n), with
+ * b >= 0.  A model that could only fit with b < 0 -- time shrinking as the
+ * queue grows -- degenerates to the constant model.  *growth is the ratio of
+ * the fitted times at the largest and the smallest size.
+ */
+static double fit(const cx_result_t *res, int model, double *growth)
+{
+    double s = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < res->points; i++) {
+        double x = model_f(model, res->n[i]), y = res->cycles[i];
+        double w = 1 / (y * y);
+        s += w;
+        sx += w * x;
+        sy += w * y;
+        sxx += w * x * x;
+        sxy += w * x * y;
+    }
+
+    double b = 0, det = s * sxx - sx * sx;
+    if (model != CX_1 && det > 0)
+        b = (s * sxy - sx * sy) / det;
+    if (b < 0)
+        b = 0;
+    double a = (sy - b * sx) / s;
+    double lo = a + b * model_f(model, res->n[0]);
+    double hi = a + b * model_f(model, res->n[res->points - 1]);
+    *growth = lo > 0 ? hi / lo : 1;
+
+    double sse = 0;
+    for (int i = 0; i < res->points; i++) {
+        double y = res->cycles[i];
+        double e = (y - a - b * model_f(model, res->n[i])) / y;
+        sse += e * e;
+    }
+    return sse;
+}
+
+bool cx_classify(const char *name, size_t max_n, cx_result_t *res)
+{
+    size_t op = 0;
+    while (op < N_OPS && strcmp(ops[op].name, name))
+        op++;
+    if (op == N_OPS)
+        return false;
+
+    if (!prng_seeded) {
+        prng_seed(&prng);
+        prng_seeded = true;
+    }
+
+    memset(res, 0, sizeof(*res));
+    int64_t overhead = cpucycles_overhead();
+    cpucycles_pin();
+    for (size_t n = CX_MIN_N; n <= max_n && res->points < CX_MAX_POINTS;
+         n *= 2) {
+        int64_t best = INT64_MAX;
+        uint64_t start = now_ns();
+        for (int r = 0; r < CX_REPS; r++) {
+            if (!ops[op].setup(n)) {
+                teardown();
+                cpucycles_unpin();
+                return false;
+            }
+            evict();
+            int64_t before = cpucycles_begin();
+            for (int i = 0; i < ops[op].calls; i++)
+                ops[op].run();
+            int64_t after = cpucycles_end();
+            teardown();
+            int64_t cycles = (after - before - overhead) / ops[op].calls;
+            if (cycles < best)
+                best = cycles;
+        }
+        res->n[res->points] = n;
+        res->cycles[res->points] = best > 0 ? best : 1;
+        res->points++;
+        if ((now_ns() - start) / CX_REPS > CX_BUDGET_NS)
+            break;
+    }
+    cpucycles_unpin();
+    if (res->points < 4)
+        return false;
+
+    /* The constant model is the baseline the others must improve on */
+    double sse[CX_NMODELS], growth[CX_NMODELS];
+    for (int m = 0; m < CX_NMODELS; m++)
+        sse[m] = fit(res, m, &growth[m]);
+
+    int best = CX_1, second = -1;
+    for (int m = 0; m < CX_NMODELS; m++) {
+        res->r2[m] = sse[CX_1] > 0 ? 1 - sse[m] / sse[CX_1] : 0;
+        if (sse[m] < sse[best])
+            best = m;
+    }
+    for (int m = 0; m < CX_NMODELS; m++) {
+        if (m != best && (second < 0 || sse[m] < sse[second]))
+            second = m;
+    }
+
+    /* Noise alone lets every model explain a little of the variance, and on
+     * flat timings a single outlier can explain most of it.  Growth counts
+     * only if it explains most of the variance and at least doubles the time
+     * over the sizes measured.
+     */
+    if (res->r2[best] < CX_MIN_R2 || growth[best] < CX_MIN_GROWTH) {
+        res->confidence = 1 - res->r2[best];
+        best = CX_1;
+    } else {
+        res->confidence = sse[second] > 0 ? 1 - sse[best] / sse[second] : 1;
+    }
+    res->model = best;
+    return true;
+}
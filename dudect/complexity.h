@@ -0,0 +1,80 @@
+#ifndef DUDECT_COMPLEXITY_H
+#define DUDECT_COMPLEXITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Empirical complexity classification.
+ *
+ * An operation is timed on queues of geometrically growing size, and the
+ * cycle counts are fitted against each growth model t = a + b * f(n) by
+ * weighted least squares.  The weights are 1 / t^2, so the fit minimises
+ * relative rather than absolute error and small sizes count as much as
+ * large ones.
+ */
+
+/* Smallest queue size measured */
+#define CX_MIN_N 16
+
+/* Default largest queue size, about 2.5 MB of nodes and strings, which
+ * stays within the reach of the TLB
+ */
+#define CX_MAX_N (1 << 14)
+
+/* Read before each timed run to push the fixture out of L1 and L2 */
+#define CX_EVICT_SIZE (8 << 20)
+
+/* Timed runs per size; the fastest one is kept */
+#define CX_REPS 7
+
+/* Stop growing the size once one run takes this long */
+#define CX_BUDGET_NS 50000000UL
+
+/* A growth model must explain this share of the variance ... */
+#define CX_MIN_R2 0.8
+
+/* ... and predict at least this much growth, else the fit is O(1) */
+#define CX_MIN_GROWTH 2.0
+
+/* At most this many sizes, up to CX_MIN_N << (CX_MAX_POINTS - 1) */
+#define CX_MAX_POINTS 24
+
+#define CX_MODELS          \
+    _(1, "O(1)")           \
+    _(logn, "O(log n)")    \
+    _(n, "O(n)")           \
+    _(nlogn, "O(n log n)") \
+    _(n2, "O(n^2)")
+
+enum {
+#define _(x, name) CX_##x,
+    CX_MODELS
+#undef _
+        CX_NMODELS
+};
+
+typedef struct {
+    int points;                    /* Number of sizes measured */
+    size_t n[CX_MAX_POINTS];       /* Queue sizes */
+    int64_t cycles[CX_MAX_POINTS]; /* Fastest run at each size, per call */
+    double r2[CX_NMODELS];         /* Goodness of fit of each model */
+    int model;                     /* Best fitting model */
+    double confidence;             /* 0 to 1, how clearly it beat the rest */
+} cx_result_t;
+
+/* Name of the i-th operation cx_classify() accepts, NULL past the last */
+const char *cx_op_name(size_t i);
+
+/* Model name, as in "O(n log n)" */
+const char *cx_model_name(int model);
+
+/* Model whose short name ("1", "logn", "n", "nlogn" or "n2") is name, or -1 */
+int cx_model_parse(const char *name);
+
+/* Time op on queues of CX_MIN_N to max_n elements and fit the models.
+ * Return: false if op is unknown or fewer than 4 sizes could be measured
+ */
+bool cx_classify(const char *op, size_t max_n, cx_result_t *res);
+
+#endif
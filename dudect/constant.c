@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "constant.h"
@@ -7,12 +9,31 @@
 #include "queue.h"
 #include "random.h"
 
-/* Maintain a queue independent from the qtest since
+/* Maintain queues independent from the qtest since
  * we do not want the test to affect the original functionality
  */
 static struct list_head *l = NULL;
 
-#define dut_new() ((void) (l = q_new()))
+/* Building a queue of up to 10000 nodes for every sample and freeing it
+ * afterwards costs far more than the one operation being timed.  Instead the
+ * queues of a small pool persist across the samples of a try: each sample
+ * takes the pooled queue whose size is closest to the one it needs, grows or
+ * shrinks it at the tail, and leaves it as the timed operation left it.
+ * Class 0 always asks for the same size and keeps reusing one queue.
+ *
+ * The fixture keeps the size of every pooled queue, and when measuring
+ * delete_mid the node q_delete_mid() removes next, so that neither picking a
+ * queue nor warming it up needs a walk.  Each timed call is checked against
+ * those sizes with q_size() once the timer has stopped, since q_size() walks
+ * a queue whose size the implementation does not track.
+ */
+#define POOL_SIZE 2
+
+static struct list_head *pool[POOL_SIZE];
+static int pool_size[POOL_SIZE];
+static struct list_head *pool_mid[POOL_SIZE];
+static int cur; /* Index of l in the pool */
+static bool follow_mid;
 
 #define dut_size(n)                                \
     do {                                           \
@@ -34,23 +55,171 @@ static struct list_head *l = NULL;
             q_insert_tail(l, s); \
     } while (0)
 
-#define dut_free() ((void) (q_free(l)))
-
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
+static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+static prng_t string_prng;
+static bool prng_seeded = false;
 
 /* Implement the necessary queue interface to simulation */
-void init_dut(void)
+void free_dut(void)
 {
+    for (int i = 0; i < POOL_SIZE; i++) {
+        q_free(pool[i]);
+        pool[i] = NULL;
+        pool_size[i] = 0;
+        pool_mid[i] = NULL;
+    }
     l = NULL;
 }
 
+/* Every try starts from a fresh pool.  Over the samples of a try, the nodes
+ * of the pooled queues scatter across the heap, and a try that inherits them
+ * sees the classes drift apart from the start.
+ */
+void init_dut(void)
+{
+    free_dut();
+}
+
 static char *get_random_string(void)
 {
     random_string_iter = (random_string_iter + 1) % N_MEASURES;
     return random_string[random_string_iter];
 }
 
+/* Grow the current queue by one node at the tail.  The middle node, at
+ * index (size - 1) / 2, moves to its next whenever the size becomes odd.
+ */
+static bool dut_push_tail(void)
+{
+    if (!q_insert_tail(l, get_random_string()))
+        return false;
+    int size = pool_size[cur]++;
+    if (follow_mid && !(size & 1))
+        pool_mid[cur] = size ? pool_mid[cur]->next : l->next;
+    return true;
+}
+
+/* Shrink the current queue by one node at the tail */
+static void dut_pop_tail(void)
+{
+    int size = pool_size[cur]--;
+    if (follow_mid && (size & 1))
+        pool_mid[cur] = size > 1 ? pool_mid[cur]->prev : NULL;
+    q_release_element(q_remove_tail(l, NULL, 0));
+}
+
+/* Account for q_delete_mid() on the current queue; must run before it */
+static void dut_pop_mid(void)
+{
+    int size = pool_size[cur]--;
+    struct list_head *mid = pool_mid[cur];
+    if (follow_mid)
+        pool_mid[cur] = size == 1 ? NULL : (size & 1) ? mid->prev : mid->next;
+}
+
+/* Point l at a pooled queue of n elements */
+static bool dut_get(int n)
+{
+    int best = 0, best_diff = INT_MAX;
+    for (int i = 0; i < POOL_SIZE && best_diff; i++) {
+        int diff = pool[i] ? abs(pool_size[i] - n) : n;
+        if (diff < best_diff) {
+            best = i;
+            best_diff = diff;
+        }
+    }
+
+    if (!pool[best] && !(pool[best] = q_new()))
+        return false;
+    l = pool[best];
+    cur = best;
+
+    while (pool_size[cur] < n) {
+        if (!dut_push_tail())
+            return false;
+    }
+    while (pool_size[cur] > n)
+        dut_pop_tail();
+    return true;
+}
+
+/* Queue size for measurement i.  The floor keeps class 0 on the same paths
+ * as class 1; an empty queue, or one that a removal empties, takes branches
+ * of its own, and the t-tests tell those apart rather than the sizes.
+ *
+ * Class 1 takes one of POOL_SIZE sizes, one per pooled queue, so that a
+ * sample of either class finds a queue within a node of its size; resizing
+ * by hundreds of nodes would churn the caches and the allocator for class 1
+ * only.  With two queues, half of class 1 shares the queue of class 0 and
+ * the other half times the operation on 5002 nodes, so that each queue is
+ * taken often enough to stay as warm as the other.
+ */
+#define DUT_MIN_SIZE 2
+#define DUT_SIZE_STEP (10000 / POOL_SIZE)
+
+static int dut_input_size(const uint8_t *input_data, size_t i)
+{
+    uint16_t x = *(uint16_t *) (input_data + i * CHUNK_SIZE);
+    return DUT_MIN_SIZE + x % POOL_SIZE * DUT_SIZE_STEP;
+}
+
+/* Read what q_delete_mid() reads and writes: the middle node, the nodes it
+ * is unlinked from, and the blocks it frees along with their bookkeeping
+ */
+static void dut_warm_mid(void)
+{
+    struct list_head *mid = pool_mid[cur];
+    element_t *e = list_entry(mid, element_t, list);
+    volatile char sink = e->value[0];
+    if (mid->prev != l)
+        sink = list_entry(mid->prev, element_t, list)->value[0];
+    if (mid->next != l)
+        sink = list_entry(mid->next, element_t, list)->value[0];
+    (void) sink;
+    test_warm_free(e->value);
+    test_warm_free(e);
+}
+
+/* Class 0 keeps reusing one tiny queue that stays in cache, while resizing
+ * the large queues of class 1 evicts whatever the timed call touches; left
+ * alone, the cache misses tell the classes apart on their own.  So for both
+ * classes, run the operation once and undo it, then read the timer into the
+ * slots the measurement will fill.
+ */
+static bool dut_warm(int mode, int64_t *before, int64_t *after)
+{
+    bool ok = true;
+    switch (mode) {
+    case DUT(insert_head):
+        if ((ok = q_insert_head(l, get_random_string())))
+            q_release_element(q_remove_head(l, NULL, 0));
+        break;
+    case DUT(insert_tail):
+        if ((ok = q_insert_tail(l, get_random_string())))
+            q_release_element(q_remove_tail(l, NULL, 0));
+        break;
+    case DUT(remove_head):
+        q_release_element(q_remove_head(l, NULL, 0));
+        ok = q_insert_head(l, get_random_string());
+        break;
+    case DUT(remove_tail):
+        q_release_element(q_remove_tail(l, NULL, 0));
+        ok = q_insert_tail(l, get_random_string());
+        break;
+    case DUT(delete_mid):
+        dut_warm_mid();
+        dut_pop_mid();
+        if ((ok = q_delete_mid(l) && dut_push_tail()))
+            dut_warm_mid();
+        break;
+    }
+    *before = cpucycles_begin();
+    *after = cpucycles_end();
+    return ok;
+}
+
 void prepare_inputs(uint8_t *input_data, uint8_t *classes)
 {
     randombytes(input_data, N_MEASURES * CHUNK_SIZE);
@@ -60,10 +229,14 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
             memset(input_data + (size_t) i * CHUNK_SIZE, 0, CHUNK_SIZE);
     }
 
+    if (!prng_seeded) {
+        prng_seed(&string_prng);
+        prng_seeded = true;
+    }
     for (size_t i = 0; i < N_MEASURES; ++i) {
         /* Generate random string */
-        randombytes((uint8_t *) random_string[i], 7);
-        random_string[i][7] = 0;
+        prng_fill_string(&string_prng, random_string[i], 7, charset,
+                         sizeof(charset) - 1);
     }
 }
 
@@ -73,89 +246,91 @@ bool measure(int64_t *before_ticks,
              int mode)
 {
     assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
+           mode == DUT(remove_head) || mode == DUT(remove_tail) ||
+           mode == DUT(delete_mid));
 
+    follow_mid = mode == DUT(delete_mid);
     switch (mode) {
     case DUT(insert_head):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n) ||
+                !dut_warm(mode, &before_ticks[i], &after_ticks[i]))
+                return false;
+            before_ticks[i] = cpucycles_begin();
             dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
+            after_ticks[i] = cpucycles_end();
+            if (q_size(l) != ++pool_size[cur])
                 return false;
         }
         break;
     case DUT(insert_tail):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n) ||
+                !dut_warm(mode, &before_ticks[i], &after_ticks[i]))
+                return false;
+            before_ticks[i] = cpucycles_begin();
             dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
+            after_ticks[i] = cpucycles_end();
+            if (q_size(l) != ++pool_size[cur])
                 return false;
         }
         break;
     case DUT(remove_head):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n) ||
+                !dut_warm(mode, &before_ticks[i], &after_ticks[i]))
+                return false;
+            before_ticks[i] = cpucycles_begin();
             element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
+            after_ticks[i] = cpucycles_end();
             if (e)
                 q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
+            if (q_size(l) != --pool_size[cur])
                 return false;
         }
         break;
     case DUT(remove_tail):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n) ||
+                !dut_warm(mode, &before_ticks[i], &after_ticks[i]))
+                return false;
+            before_ticks[i] = cpucycles_begin();
             element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
+            after_ticks[i] = cpucycles_end();
             if (e)
                 q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
+            if (q_size(l) != --pool_size[cur])
+                return false;
+        }
+        break;
+    case DUT(delete_mid):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n) ||
+                !dut_warm(mode, &before_ticks[i], &after_ticks[i]))
+                return false;
+            dut_pop_mid();
+            before_ticks[i] = cpucycles_begin();
+            bool ok = q_delete_mid(l);
+            after_ticks[i] = cpucycles_end();
+            if (!ok || q_size(l) != pool_size[cur])
                 return false;
         }
         break;
     default:
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
+            int n = dut_input_size(input_data, i);
+            if (!dut_get(n))
+                return false;
+            before_ticks[i] = cpucycles_begin();
             dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
+            after_ticks[i] = cpucycles_end();
         }
     }
     return true;
@@ -16,7 +16,8 @@
     _(insert_head) \
     _(insert_tail) \
     _(remove_head) \
-    _(remove_tail)
+    _(remove_tail) \
+    _(delete_mid)
 
 #define DUT(x) DUT_##x
 
@@ -27,6 +28,7 @@ enum {
 };
 
 void init_dut();
+void free_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
@@ -0,0 +1,100 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cpucycles.h"
+
+#define CALIBRATE_RUNS 1000
+#define CALIBRATE_NS 10000000
+
+static int64_t overhead = -1;
+static double hz;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void calibrate(void)
+{
+    /* The fastest empty pair is the cost of the reads themselves */
+    overhead = INT64_MAX;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        int64_t before = cpucycles_begin();
+        int64_t after = cpucycles_end();
+        if (after - before < overhead)
+            overhead = after - before;
+    }
+    if (overhead < 0)
+        overhead = 0;
+
+#if defined(__aarch64__)
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    hz = freq;
+#else
+    int64_t t0 = now_ns(), c0 = cpucycles_begin(), t1;
+    do {
+        t1 = now_ns();
+    } while (t1 - t0 < CALIBRATE_NS);
+    int64_t c1 = cpucycles_end();
+    hz = (double) (c1 - c0) * 1e9 / (double) (t1 - t0);
+#endif
+}
+
+int64_t cpucycles_overhead(void)
+{
+    if (overhead < 0)
+        calibrate();
+    return overhead;
+}
+
+double cpucycles_hz(void)
+{
+    if (overhead < 0)
+        calibrate();
+    return hz;
+}
+
+#if defined(__linux__)
+static cpu_set_t saved_set;
+static bool pinned = false;
+
+bool cpucycles_pin(void)
+{
+    if (pinned)
+        return true;
+
+    int cpu = sched_getcpu();
+    if (cpu < 0 || sched_getaffinity(0, sizeof(saved_set), &saved_set))
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pinned = !sched_setaffinity(0, sizeof(set), &set);
+    return pinned;
+}
+
+void cpucycles_unpin(void)
+{
+    if (pinned)
+        sched_setaffinity(0, sizeof(saved_set), &saved_set);
+    pinned = false;
+}
+#else
+/* macOS offers only affinity hints, which Apple silicon ignores */
+bool cpucycles_pin(void)
+{
+    return false;
+}
+
+void cpucycles_unpin(void) {}
+#endif
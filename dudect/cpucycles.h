@@ -1,14 +1,21 @@
 #ifndef DUDECT_CPUCYCLES_H
 #define DUDECT_CPUCYCLES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-// http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
-static inline int64_t cpucycles(void)
+/* Read the cycle counter at the start of a timed region.  The fences keep
+ * the read from moving above earlier instructions or below later ones, so
+ * none of the surrounding code is counted in or out by out-of-order
+ * execution.
+ * http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
+ */
+static inline int64_t cpucycles_begin(void)
 {
 #if defined(__i386__) || defined(__x86_64__)
     unsigned int hi, lo;
-    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+    __asm__ volatile("lfence\n\trdtsc\n\tlfence"
+                     : "=a"(lo), "=d"(hi)::"memory");
     return ((int64_t) lo) | (((int64_t) hi) << 32);
 
 #elif defined(__aarch64__)
@@ -19,11 +26,56 @@ static inline int64_t cpucycles(void)
      * bits wide and it is attributed with the flag 'cap_user_time_short'
      * is true.
      */
-    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(val)::"memory");
     return val;
 #else
 #error Unsupported Architecture
 #endif
 }
 
+/* Read the cycle counter at the end of a timed region.  rdtscp waits for
+ * the timed instructions to complete, and the trailing fence keeps later
+ * ones from starting before the read.
+ */
+static inline int64_t cpucycles_end(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo, aux;
+    __asm__ volatile("rdtscp\n\tlfence"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val)::"memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+static inline int64_t cpucycles(void)
+{
+    return cpucycles_begin();
+}
+
+/* Ticks an empty cpucycles_begin()/cpucycles_end() pair takes, to be
+ * subtracted from measurements.  Calibrated on first use.
+ */
+int64_t cpucycles_overhead(void);
+
+/* Counter frequency in Hz, measured against CLOCK_MONOTONIC on x86 and read
+ * from cntfrq_el0 on arm64.  Calibrated on first use.
+ */
+double cpucycles_hz(void);
+
+/* Pin the calling thread to the CPU it is running on, so that a series of
+ * measurements neither migrates between cores nor mixes their counters.
+ * Return: false if the affinity could not be changed; measuring still works
+ */
+bool cpucycles_pin(void);
+
+/* Restore the affinity saved by cpucycles_pin() */
+void cpucycles_unpin(void);
+
 #endif
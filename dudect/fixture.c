@@ -37,13 +37,24 @@
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
 #include "fixture.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
 #define TEST_TRIES 10
 
+/* Measurements of each batch that are actually timed */
+#define N_SAMPLES (N_MEASURES - DROP_SIZE * 2)
+
+#define N_PERCENTILES 100
+
+/* Uncropped, cropped at each percentile, and second order */
+#define N_TESTS (N_PERCENTILES + 2)
+#define SECOND_ORDER (N_PERCENTILES + 1)
+
 static t_context_t *t;
+static double crops[N_PERCENTILES + 1];
 
 /* threshold values for Welch's t-test */
 enum {
@@ -60,8 +71,15 @@ static void differentiate(int64_t *exec_times,
                           const int64_t *before_ticks,
                           const int64_t *after_ticks)
 {
-    for (size_t i = 0; i < N_MEASURES; i++)
-        exec_times[i] = after_ticks[i] - before_ticks[i];
+    /* Without the cost of reading the counter, both classes differ only by
+     * what the operation itself takes
+     */
+    int64_t overhead = cpucycles_overhead();
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        exec_times[i] = after_ticks[i] - before_ticks[i] - overhead;
+        if (exec_times[i] < 0)
+            exec_times[i] = 0;
+    }
 }
 
 static int cmp(const int64_t *a, const int64_t *b)
@@ -78,42 +96,81 @@ static int64_t percentile(int64_t *a_sorted, double which, size_t size)
     return a_sorted[array_position];
 }
 
-static void prepare_percenrile(int64_t *exec_times, int64_t *percentiles)
+/* Crop thresholds, set from the first batch of each try: tests[0] keeps every
+ * measurement, tests[i] keeps those below the 1 - 0.5^(10 i / N_PERCENTILES)
+ * quantile, which packs the thresholds towards the fast end
+ */
+static void prepare_percentiles(const int64_t *exec_times)
 {
-    qsort(exec_times, N_MEASURES, sizeof(int64_t),
+    int64_t sorted[N_SAMPLES];
+    memcpy(sorted, exec_times + DROP_SIZE, sizeof(sorted));
+    qsort(sorted, N_SAMPLES, sizeof(int64_t),
           (int (*)(const void *, const void *)) cmp);
-    for (size_t i = 0; i < N_MEASURES; i++) {
-        percentiles[i] = percentile(
-            exec_times, 1 - (pow(0.5, 10 * (double) (i + 1) / N_MEASURES)),
-            N_MEASURES);
+    crops[0] = T_NO_CROP;
+    for (size_t i = 1; i <= N_PERCENTILES; i++) {
+        crops[i] = percentile(
+            sorted, 1 - (pow(0.5, 10 * (double) i / N_PERCENTILES)), N_SAMPLES);
+    }
+}
+
+static void update_statistics(const int64_t *exec_times, uint8_t *classes)
+{
+    double x[N_SAMPLES], centered[N_SAMPLES];
+    const uint8_t *c = classes + DROP_SIZE;
+    for (size_t i = 0; i < N_SAMPLES; i++)
+        x[i] = exec_times[DROP_SIZE + i];
+
+    /* The second-order test compares the variances of the classes, as the
+     * means of the squared distances from the class means; these come from
+     * the uncropped test, once it has seen both classes
+     */
+    bool second_order = t[0].n[0] > 0 && t[0].n[1] > 0;
+    for (size_t i = 0; second_order && i < N_SAMPLES; i++) {
+        double d = x[i] - t[0].mean[c[i]];
+        centered[i] = d * d;
+    }
+
+    /* do t-tests on the execution time, uncropped and at every crop */
+    t_push_batch(t, crops, N_PERCENTILES + 1, x, c, N_SAMPLES);
+    if (second_order) {
+        const double no_crop = T_NO_CROP;
+        t_push_batch(&t[SECOND_ORDER], &no_crop, 1, centered, c, N_SAMPLES);
     }
 }
 
-static void update_statistics(const int64_t *exec_times,
-                              uint8_t *classes,
-                              const int64_t *percentiles)
+/* The largest t statistic among the tests with enough measurements to
+ * count, and that test in *max
+ */
+static double max_test(t_context_t **max)
 {
-    for (size_t i = 10; i < N_MEASURES; i++) {
-        int64_t difference = exec_times[i];
-        /* CPU cycle counter overflowed or dropped measurement */
-        if (difference >= percentiles[i])
+    double max_t = 0;
+    *max = &t[0];
+    for (size_t i = 0; i < N_TESTS; i++) {
+        if (t[i].n[0] + t[i].n[1] < ENOUGH_MEASURE / 10 || !t[i].n[0] ||
+            !t[i].n[1])
             continue;
-        /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        double t_i = fabs(t_compute(&t[i]));
+        if (t_i > max_t) {
+            *max = &t[i];
+            max_t = t_i;
+        }
     }
+    return max_t;
 }
 
 static bool report(void)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
+    t_context_t *test;
+    double max_t = max_test(&test);
+    double number_traces_max_t = test->n[0] + test->n[1];
     double max_tau = max_t / sqrt(number_traces_max_t);
 
     printf("\033[A\033[2K");
     printf("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    if (t[0].n[0] + t[0].n[1] < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - t[0].n[0] - t[0].n[1]);
+        fflush(stdout);
         return false;
     }
 
@@ -129,6 +186,8 @@ static bool report(void)
      */
     printf("max t: %+7.2f, max tau: %.2e, (5/tau)^2: %.2e.\n", max_t, max_tau,
            (double) (5 * 5) / (double) (max_tau * max_tau));
+    /* Console output is batched per command; keep the progress line live */
+    fflush(stdout);
 
     /* Definitely not constant time */
     if (max_t > t_threshold_bananas)
@@ -150,8 +209,6 @@ static bool doit(int mode)
     uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
     uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
 
-    int64_t *percentiles = calloc(N_MEASURES, sizeof(int64_t));
-
     if (!before_ticks || !after_ticks || !exec_times || !classes ||
         !input_data) {
         die();
@@ -161,8 +218,9 @@ static bool doit(int mode)
 
     bool ret = measure(before_ticks, after_ticks, input_data, mode);
     differentiate(exec_times, before_ticks, after_ticks);
-    prepare_percenrile(exec_times, percentiles);
-    update_statistics(exec_times, classes, percentiles);
+    if (!t[0].n[0] && !t[0].n[1])
+        prepare_percentiles(exec_times);
+    update_statistics(exec_times, classes);
     ret &= report();
 
     free(before_ticks);
@@ -170,7 +228,6 @@ static bool doit(int mode)
     free(exec_times);
     free(classes);
     free(input_data);
-    free(percentiles);
 
     return ret;
 }
@@ -178,24 +235,27 @@ static bool doit(int mode)
 static void init_once(void)
 {
     init_dut();
-    t_init(t);
+    for (size_t i = 0; i < N_TESTS; i++)
+        t_init(&t[i]);
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_context_t));
+    t = malloc(N_TESTS * sizeof(t_context_t));
+    cpucycles_pin();
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
         init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
+        for (int i = 0; i < ENOUGH_MEASURE / N_SAMPLES + 1; ++i)
             result = doit(mode);
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
+    free_dut();
+    cpucycles_unpin();
     free(t);
     return result;
 }
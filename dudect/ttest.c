@@ -27,6 +27,80 @@ void t_push(t_context_t *ctx, double x, uint8_t class)
     ctx->m2[class] = ctx->m2[class] + delta * (x - ctx->mean[class]);
 }
 
+/* Contexts accumulated side by side in one pass over a batch */
+#define T_LANES 8
+
+/* Merge a batch with count nb, mean mb and sum of squared deviations m2b
+ * into the context, by the parallel variant of Welford's method (Chan et
+ * al.), which needs one division per batch rather than one per sample.
+ */
+static void t_merge(t_context_t *ctx,
+                    uint8_t class,
+                    double nb,
+                    double mb,
+                    double m2b)
+{
+    if (nb == 0)
+        return;
+    double na = ctx->n[class], n = na + nb;
+    double delta = mb - ctx->mean[class];
+    ctx->mean[class] += delta * nb / n;
+    ctx->m2[class] += m2b + delta * delta * na * nb / n;
+    ctx->n[class] = n;
+}
+
+void t_push_batch(t_context_t *ctx,
+                  const double *crop,
+                  size_t nctx,
+                  const double *x,
+                  const uint8_t *classes,
+                  size_t n)
+{
+    if (!n)
+        return;
+
+    /* Sums of deviations from a shift near the mean are as accurate as
+     * Welford's updates while the shift is within the spread of the data,
+     * and need only one pass
+     */
+    double shift = x[0];
+    for (size_t base = 0; base < nctx; base += T_LANES) {
+        size_t lanes = nctx - base < T_LANES ? nctx - base : T_LANES;
+        double limit[T_LANES];
+        double cnt[2][T_LANES] = {{0}}, s1[2][T_LANES] = {{0}},
+               s2[2][T_LANES] = {{0}};
+
+        /* Unused lanes crop everything, so the inner loop can always run
+         * over all T_LANES and be vectorised with masks instead of branches
+         */
+        for (size_t j = 0; j < T_LANES; j++)
+            limit[j] = j < lanes ? crop[base + j] : -INFINITY;
+
+        for (size_t i = 0; i < n; i++) {
+            uint8_t c = classes[i];
+            assert(c == 0 || c == 1);
+            double d = x[i] - shift;
+            for (size_t j = 0; j < T_LANES; j++) {
+                double keep = x[i] < limit[j];
+                cnt[c][j] += keep;
+                s1[c][j] += keep * d;
+                s2[c][j] += keep * d * d;
+            }
+        }
+
+        for (size_t j = 0; j < lanes; j++) {
+            for (uint8_t c = 0; c < 2; c++) {
+                if (cnt[c][j] == 0)
+                    continue;
+                double mean = s1[c][j] / cnt[c][j];
+                double m2 = s2[c][j] - s1[c][j] * mean;
+                t_merge(&ctx[base + j], c, cnt[c][j], shift + mean,
+                        m2 > 0 ? m2 : 0);
+            }
+        }
+    }
+}
+
 double t_compute(t_context_t *ctx)
 {
     double var[2] = {0.0, 0.0};
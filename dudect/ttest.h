@@ -1,6 +1,8 @@
 #ifndef DUDECT_TTEST_H
 #define DUDECT_TTEST_H
 
+#include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct {
@@ -9,7 +11,20 @@ typedef struct {
     double n[2];
 } t_context_t;
 
+/* Crop threshold that keeps every sample */
+#define T_NO_CROP INFINITY
+
 void t_push(t_context_t *ctx, double x, uint8_t class);
+
+/* Add n samples, x[i] of class classes[i], to each of nctx contexts, where
+ * ctx[j] only takes the samples below crop[j].
+ */
+void t_push_batch(t_context_t *ctx,
+                  const double *crop,
+                  size_t nctx,
+                  const double *x,
+                  const uint8_t *classes,
+                  size_t n);
 double t_compute(t_context_t *ctx);
 void t_init(t_context_t *ctx);
 
@@ -19,6 +19,9 @@
 /* Value at start of every allocated block */
 #define MAGICHEADER 0xdeadbeef
 
+/* Value at start of blocks allocated in fixture mode */
+#define MAGICFIXTURE 0xdeadf1c5
+
 /* Value when deallocate block */
 #define MAGICFREE 0xffffffff
 
@@ -48,6 +51,7 @@ static size_t allocated_count = 0;
 int fail_probability = 0;
 
 static bool cautious_mode = true;
+static bool fixture_mode = false;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
@@ -86,7 +90,8 @@ static block_element_t *find_header(void *p)
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
+    /* A fixture frees its own blocks, and may hold many of them */
+    if (cautious_mode && b->magic_header != MAGICFIXTURE) {
         /* Make sure this is really an allocated block */
         block_element_t *ab = allocated;
         bool found = false;
@@ -102,7 +107,7 @@ static block_element_t *find_header(void *p)
         }
     }
 
-    if (b->magic_header != MAGICHEADER) {
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICFIXTURE) {
         report_event(
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
@@ -150,7 +155,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
+    new_block->magic_header = fixture_mode ? MAGICFIXTURE : MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
@@ -224,6 +229,21 @@ void test_free(void *p)
     allocated_count--;
 }
 
+void test_warm_free(void *p)
+{
+    if (!p)
+        return;
+
+    block_element_t *b =
+        (block_element_t *) ((size_t) p - sizeof(block_element_t));
+    volatile size_t sink = b->magic_header + *find_footer(b);
+    if (b->next)
+        sink = b->next->magic_header;
+    if (b->prev)
+        sink = b->prev->magic_header;
+    (void) sink;
+}
+
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
@@ -250,6 +270,14 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+/* Set/unset fixture mode.
+ * Blocks allocated in this mode are freed without the search of cautious mode.
+ */
+void set_fixture_mode(bool fixture)
+{
+    fixture_mode = fixture;
+}
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
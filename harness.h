@@ -16,6 +16,13 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/* Read the bookkeeping that test_free(p) reads and writes: the header and
+ * footer of the block, and the headers of the blocks allocated next to it.
+ * A measurement that times a free calls it first, so that the misses on that
+ * bookkeeping do not depend on the age of the block.
+ */
+void test_warm_free(void *p);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
@@ -30,6 +37,14 @@ extern int fail_probability;
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Set/unset fixture mode.
+ * Blocks allocated in this mode belong to a test fixture, such as the queues
+ * dudect keeps across samples, and are freed without the search of cautious
+ * mode: that search takes time linear in the number of allocated blocks.
+ */
+void set_fixture_mode(bool fixture);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
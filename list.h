@@ -462,6 +462,113 @@ static inline void list_move_tail(struct list_head *node,
          ++(entry), ++(safe))
 #endif
 
+/**
+ * list_prefetch() - Hint that memory at @addr is about to be read
+ * @addr: address to be fetched into the cache
+ *
+ * Compiles to nothing when LIST_PREFETCH_DISTANCE is 0, or when the compiler
+ * has no prefetch builtin.
+ */
+#ifndef LIST_PREFETCH_DISTANCE
+#define LIST_PREFETCH_DISTANCE 4
+#endif
+
+#if LIST_PREFETCH_DISTANCE > 0 && (defined(__GNUC__) || defined(__clang__))
+#define list_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define list_prefetch(addr) ((void) (addr))
+#endif
+
+/**
+ * list_prefetch_init() - Start a prefetch cursor ahead of @node
+ * @node: first node to be visited
+ * @head: pointer to the head of the list
+ *
+ * Return: the node LIST_PREFETCH_DISTANCE nodes after @node, or @head if the
+ * list ends first.  Every node passed on the way is prefetched.
+ */
+static inline struct list_head *list_prefetch_init(struct list_head *node,
+                                                   struct list_head *head)
+{
+    for (int i = 0; i < LIST_PREFETCH_DISTANCE && node != head; i++) {
+        node = node->next;
+        list_prefetch(node);
+    }
+    return LIST_PREFETCH_DISTANCE > 0 ? node : head;
+}
+
+/**
+ * list_prefetch_step() - Advance a prefetch cursor by one node
+ * @ahead: prefetch cursor
+ * @head: pointer to the head of the list
+ *
+ * Return: the node after @ahead, which is prefetched, or @head at the end.
+ */
+static inline struct list_head *list_prefetch_step(struct list_head *ahead,
+                                                   struct list_head *head)
+{
+    if (ahead != head) {
+        ahead = ahead->next;
+        list_prefetch(ahead);
+    }
+    return ahead;
+}
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching ahead
+ * @node: list_head pointer used as iterator
+ * @ahead: list_head pointer used as prefetch cursor
+ * @head: pointer to the head of the list
+ *
+ * Like list_for_each(), but @ahead runs LIST_PREFETCH_DISTANCE nodes in
+ * front of @node, so the nodes are already in the cache when @node reaches
+ * them.  The body may prefetch data referenced by @ahead as well, unless
+ * @ahead is @head.  Pays off on lists much larger than the cache, whose
+ * nodes are scattered in memory.
+ */
+#define list_for_each_prefetch(node, ahead, head)                     \
+    for (node = (head)->next, ahead = list_prefetch_init(node, head); \
+         node != (head);                                              \
+         node = node->next, ahead = list_prefetch_step(ahead, head))
+
+/**
+ * list_for_each_safe_prefetch - Iterate over nodes, prefetching ahead, safe
+ *                               against removal of the current node
+ * @node: list_head pointer used as iterator
+ * @safe: list_head pointer used to store info for next entry in list
+ * @ahead: list_head pointer used as prefetch cursor
+ * @head: pointer to the head of the list
+ *
+ * Like list_for_each_safe(), with @ahead as in list_for_each_prefetch().
+ * The body must not remove the nodes between @safe and @ahead.
+ */
+#define list_for_each_safe_prefetch(node, safe, ahead, head)           \
+    for (node = (head)->next, safe = node->next,                       \
+        ahead = list_prefetch_init(node, head);                        \
+         node != (head); node = safe, safe = node->next,               \
+        ahead = list_prefetch_step(ahead, head))
+
+/**
+ * list_for_each_entry_prefetch - Iterate over entries, prefetching ahead
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @ahead: list_head pointer used as prefetch cursor
+ * @head: Pointer to the list_head structure representing the list head.
+ * @member: Name of the list_head member within the structure type of @entry.
+ *
+ * Like list_for_each_entry(), with @ahead as in list_for_each_prefetch().
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_prefetch(entry, ahead, head, member)           \
+    for (entry = list_entry((head)->next, typeof(*entry), member),         \
+        ahead = list_prefetch_init(&entry->member, head);                  \
+         &entry->member != (head);                                         \
+         entry = list_entry(entry->member.next, typeof(*entry), member),   \
+        ahead = list_prefetch_step(ahead, head))
+#else
+#define list_for_each_entry_prefetch(entry, ahead, head, member) \
+    for (entry = (void *) 1; sizeof(struct { int i : -1; }); ++(entry))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
@@ -0,0 +1,133 @@
+/* Prometheus-style runtime metrics */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#define NSEC_PER_SEC 1000000000UL
+
+uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+/* Index of the log2 bucket holding ns */
+static inline int metrics_bucket(uint64_t ns)
+{
+    if (!ns)
+        return 0;
+    int k = 63 - __builtin_clzll(ns);
+    return k < METRICS_BUCKETS ? k : METRICS_BUCKETS - 1;
+}
+
+void metrics_observe(metrics_hist_t *h, uint64_t ns, bool ok)
+{
+    __atomic_fetch_add(&h->bucket[metrics_bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    if (!ok)
+        __atomic_fetch_add(&h->errors, 1, __ATOMIC_RELAXED);
+}
+
+static inline int metrics_hdr_index(uint64_t v)
+{
+    if (v < METRICS_HDR_SUB)
+        return v;
+    if (v >> METRICS_HDR_BITS)
+        return METRICS_HDR_BUCKETS - 1;
+    /* v >> shift is in [METRICS_HDR_SUB, 2 * METRICS_HDR_SUB) */
+    int shift = 63 - __builtin_clzll(v) - METRICS_HDR_SUB_BITS;
+    return shift * METRICS_HDR_SUB + (int) (v >> shift);
+}
+
+void metrics_hdr_record(metrics_hdr_t *h, uint64_t v)
+{
+    h->bucket[metrics_hdr_index(v)]++;
+    if (!h->count || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    h->sum += v;
+}
+
+uint64_t metrics_hdr_percentile(const metrics_hdr_t *h, double p)
+{
+    if (!h->count)
+        return 0;
+
+    uint64_t rank = p * h->count;
+    if (rank >= h->count)
+        return h->max;
+    uint64_t seen = 0;
+    int i = 0;
+    while ((seen += h->bucket[i]) <= rank)
+        i++;
+    if (i < 2 * METRICS_HDR_SUB)
+        return i;
+
+    /* Middle of the bucket, which halves the worst-case error */
+    int shift = i / METRICS_HDR_SUB - 1;
+    uint64_t lo = (uint64_t) (i - shift * METRICS_HDR_SUB) << shift;
+    uint64_t v = lo + ((1ULL << shift) >> 1);
+    if (v < h->min)
+        return h->min;
+    return v < h->max ? v : h->max;
+}
+
+void metrics_write_family(FILE *out,
+                          const char *name,
+                          const char *type,
+                          const char *help)
+{
+    fprintf(out, "# HELP %s %s\n", name, help);
+    fprintf(out, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_write_hist(FILE *out,
+                        const char *name,
+                        const char *label,
+                        const char *value,
+                        const metrics_hist_t *h)
+{
+    uint64_t snap[METRICS_BUCKETS];
+    int last = 0;
+    for (int k = 0; k < METRICS_BUCKETS; k++) {
+        snap[k] = __atomic_load_n(&h->bucket[k], __ATOMIC_RELAXED);
+        if (snap[k])
+            last = k;
+    }
+
+    /* Buckets above the largest observation carry no information, so the
+     * series stops there.  Cumulative counts are derived from the snapshot,
+     * which keeps "+Inf" and "_count" consistent with the buckets.
+     */
+    uint64_t cumulative = 0;
+    for (int k = 0; k <= last; k++) {
+        cumulative += snap[k];
+        fprintf(out, "%s_bucket{%s=\"%s\",le=\"%.9g\"} %" PRIu64 "\n", name,
+                label, value, (double) (2ULL << k) / NSEC_PER_SEC,
+                cumulative);
+    }
+    fprintf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", name, label,
+            value, cumulative);
+    fprintf(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value,
+            (double) __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED) /
+                NSEC_PER_SEC);
+    fprintf(out, "%s_count{%s=\"%s\"} %" PRIu64 "\n", name, label, value,
+            cumulative);
+}
+
+void metrics_write_value(FILE *out,
+                         const char *name,
+                         const char *type,
+                         const char *help,
+                         uint64_t value)
+{
+    metrics_write_family(out, name, type, help);
+    fprintf(out, "%s %" PRIu64 "\n", name, value);
+}
@@ -0,0 +1,79 @@
+#ifndef LAB0_METRICS_H
+#define LAB0_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Runtime counters and latency histograms, rendered in the Prometheus text
+ * exposition format so that long-running sessions can be scraped.
+ */
+
+/* Latency histogram with log2 buckets: bucket k counts samples in
+ * [2^k, 2^(k+1)) nanoseconds, the last bucket also takes everything above.
+ */
+#define METRICS_BUCKETS 40
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t sum_ns;
+    uint64_t bucket[METRICS_BUCKETS];
+} metrics_hist_t;
+
+/* Log-linear (HDR-style) histogram.  Values below 2 * METRICS_HDR_SUB are
+ * counted exactly; above, every power of two is split into METRICS_HDR_SUB
+ * equal buckets, so any value is resolved to within 1/METRICS_HDR_SUB of
+ * itself.  Values of 2^METRICS_HDR_BITS ns (about 18 minutes) and more share
+ * the last bucket.
+ */
+#define METRICS_HDR_SUB_BITS 5
+#define METRICS_HDR_SUB (1 << METRICS_HDR_SUB_BITS)
+#define METRICS_HDR_BITS 40
+#define METRICS_HDR_BUCKETS \
+    ((METRICS_HDR_BITS - METRICS_HDR_SUB_BITS + 1) * METRICS_HDR_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min, max;
+    uint64_t bucket[METRICS_HDR_BUCKETS];
+} metrics_hdr_t;
+
+/* Monotonic time in nanoseconds */
+uint64_t metrics_now_ns(void);
+
+/* Record one observation.  Counters are bumped with relaxed atomic adds, so
+ * a concurrent reader never blocks the recording thread.
+ */
+void metrics_observe(metrics_hist_t *h, uint64_t ns, bool ok);
+
+/* Record one value; zero the histogram to reset it */
+void metrics_hdr_record(metrics_hdr_t *h, uint64_t v);
+
+/* Value at or below which a share p (0 to 1) of the recorded values lie,
+ * to the resolution of the buckets; 0 if the histogram is empty
+ */
+uint64_t metrics_hdr_percentile(const metrics_hdr_t *h, double p);
+
+/* Emit the HELP and TYPE lines of a metric family */
+void metrics_write_family(FILE *out,
+                          const char *name,
+                          const char *type,
+                          const char *help);
+
+/* Emit the _bucket, _sum and _count series of a histogram family member */
+void metrics_write_hist(FILE *out,
+                        const char *name,
+                        const char *label,
+                        const char *value,
+                        const metrics_hist_t *h);
+
+/* Emit a complete single-valued family (counter or gauge) */
+void metrics_write_value(FILE *out,
+                         const char *name,
+                         const char *type,
+                         const char *help,
+                         uint64_t value);
+
+#endif /* LAB0_METRICS_H */
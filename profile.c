@@ -0,0 +1,306 @@
+/* Sampling CPU profiler writing folded stacks */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include "profile.h"
+
+/* The handler and the signal trampoline are on top of every stack */
+#define SKIP_FRAMES 2
+
+typedef struct {
+    void *frames[PROFILE_DEPTH + SKIP_FRAMES];
+    int depth;
+} sample_t;
+
+static sample_t *samples;
+static long nsamples; /* Slots claimed, may exceed PROFILE_MAX_SAMPLES */
+static int in_handler; /* Handlers still running on any thread */
+static bool running = false;
+
+/* Runs on whichever thread was on the CPU; slots are claimed atomically, and
+ * nothing here allocates or takes a lock.
+ */
+static void profile_handler(int sig)
+{
+    (void) sig;
+    int saved_errno = errno;
+    __atomic_add_fetch(&in_handler, 1, __ATOMIC_ACQUIRE);
+    long i = __atomic_fetch_add(&nsamples, 1, __ATOMIC_RELAXED);
+    if (i < PROFILE_MAX_SAMPLES) {
+        sample_t *s = &samples[i];
+        s->depth = backtrace(s->frames, PROFILE_DEPTH + SKIP_FRAMES);
+    }
+    __atomic_sub_fetch(&in_handler, 1, __ATOMIC_RELEASE);
+    errno = saved_errno;
+}
+
+bool profile_running(void)
+{
+    return running;
+}
+
+bool profile_start(int hz)
+{
+    if (running || hz < 1 || hz > 1000000)
+        return false;
+
+    samples = calloc(PROFILE_MAX_SAMPLES, sizeof(sample_t));
+    if (!samples)
+        return false;
+    nsamples = 0;
+
+    /* The first backtrace() loads the unwinder, which must not happen in
+     * the signal handler
+     */
+    void *prime[1];
+    backtrace(prime, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profile_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    long usec = 1000000 / hz;
+    struct itimerval it = {
+        .it_interval = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+        .it_value = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+    };
+    if (sigaction(SIGPROF, &sa, NULL)) {
+        free(samples);
+        return false;
+    }
+    if (setitimer(ITIMER_PROF, &it, NULL)) {
+        signal(SIGPROF, SIG_IGN);
+        free(samples);
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+/* Function symbols of the executable itself, which unlike dladdr() also
+ * covers static functions, as long as the binary is not stripped
+ */
+typedef struct {
+    uintptr_t addr, size;
+    const char *name;
+} func_sym_t;
+
+static struct {
+    void *map;
+    size_t map_size;
+    func_sym_t *syms;
+    size_t n;
+    uintptr_t bias; /* Load address of a position-independent executable */
+} exe;
+
+static int cmp_sym(const void *a, const void *b)
+{
+    uintptr_t x = ((const func_sym_t *) a)->addr;
+    uintptr_t y = ((const func_sym_t *) b)->addr;
+    return (x > y) - (x < y);
+}
+
+#ifdef __linux__
+static int find_bias(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void) size;
+    /* The executable comes first */
+    *(uintptr_t *) data = info->dlpi_addr;
+    return 1;
+}
+
+static void exe_load(void)
+{
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    exe.map = map;
+    exe.map_size = st.st_size;
+
+    const ElfW(Ehdr) *eh = map;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+        eh->e_shoff + (size_t) eh->e_shnum * sizeof(ElfW(Shdr)) >
+            exe.map_size)
+        return;
+    const ElfW(Shdr) *sh = (const void *) ((const char *) map + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+        const ElfW(Shdr) *strs = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > exe.map_size ||
+            strs->sh_offset + strs->sh_size > exe.map_size)
+            return;
+        const ElfW(Sym) *sym =
+            (const void *) ((const char *) map + sh[i].sh_offset);
+        const char *strtab = (const char *) map + strs->sh_offset;
+        size_t n = sh[i].sh_size / sizeof(ElfW(Sym));
+
+        exe.syms = malloc(n * sizeof(func_sym_t));
+        if (!exe.syms)
+            return;
+        for (size_t j = 0; j < n; j++) {
+            if (ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC ||
+                !sym[j].st_value || sym[j].st_name >= strs->sh_size)
+                continue;
+            exe.syms[exe.n++] = (func_sym_t){
+                .addr = sym[j].st_value,
+                .size = sym[j].st_size,
+                .name = strtab + sym[j].st_name,
+            };
+        }
+        qsort(exe.syms, exe.n, sizeof(func_sym_t), cmp_sym);
+        dl_iterate_phdr(find_bias, &exe.bias);
+        return;
+    }
+}
+#else
+static void exe_load(void) {}
+#endif
+
+static void exe_unload(void)
+{
+    free(exe.syms);
+    if (exe.map)
+        munmap(exe.map, exe.map_size);
+    memset(&exe, 0, sizeof(exe));
+}
+
+static const char *symbolize(void *pc)
+{
+    uintptr_t a = (uintptr_t) pc - exe.bias;
+    size_t lo = 0, hi = exe.n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (exe.syms[mid].addr <= a)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo && a < exe.syms[lo - 1].addr + exe.syms[lo - 1].size)
+        return exe.syms[lo - 1].name;
+
+    /* Shared libraries export the functions worth naming */
+    Dl_info info;
+    if (!dladdr(pc, &info))
+        return "??";
+    if (info.dli_sname)
+        return info.dli_sname;
+    if (!info.dli_fname)
+        return "??";
+    const char *base = strrchr(info.dli_fname, '/');
+    return base ? base + 1 : info.dli_fname;
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Join the frames of every sample into a line, root first, and count the
+ * runs of equal lines after sorting
+ */
+static bool write_folded(const char *file, long n)
+{
+    FILE *out = fopen(file, "w");
+    if (!out)
+        return false;
+
+    char **lines = calloc(n ? n : 1, sizeof(char *));
+    bool ok = lines;
+    exe_load();
+    for (long i = 0; ok && i < n; i++) {
+        sample_t *s = &samples[i];
+        char *line = NULL;
+        size_t len = 0;
+        FILE *f = open_memstream(&line, &len);
+        if (!f) {
+            ok = false;
+            break;
+        }
+        for (int d = s->depth - 1; d >= SKIP_FRAMES; d--) {
+            /* Return addresses point past the call; look up the call */
+            char *pc = (char *) s->frames[d] - (d > SKIP_FRAMES);
+            fprintf(f, d < s->depth - 1 ? ";%s" : "%s", symbolize(pc));
+        }
+        ok = !fclose(f);
+        lines[i] = line;
+    }
+    exe_unload();
+
+    if (ok) {
+        qsort(lines, n, sizeof(char *), cmp_str);
+        for (long i = 0; i < n;) {
+            long j = i + 1;
+            while (j < n && !strcmp(lines[i], lines[j]))
+                j++;
+            if (*lines[i])
+                fprintf(out, "%s %ld\n", lines[i], j - i);
+            i = j;
+        }
+    }
+    for (long i = 0; lines && i < n; i++)
+        free(lines[i]);
+    free(lines);
+
+    ok = !ferror(out) && ok;
+    return !fclose(out) && ok;
+}
+
+bool profile_stop(const char *file, long *taken, long *dropped)
+{
+    if (!running)
+        return false;
+
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+    /* A signal may still be pending, which by default would terminate the
+     * process; ignore it, and let handlers on other threads finish before
+     * the buffer goes away
+     */
+    signal(SIGPROF, SIG_IGN);
+    while (__atomic_load_n(&in_handler, __ATOMIC_ACQUIRE))
+        sched_yield();
+    running = false;
+
+    long n = __atomic_load_n(&nsamples, __ATOMIC_RELAXED);
+    long kept = n < PROFILE_MAX_SAMPLES ? n : PROFILE_MAX_SAMPLES;
+    if (taken)
+        *taken = kept;
+    if (dropped)
+        *dropped = n - kept;
+
+    bool ok = !file || write_folded(file, kept);
+    free(samples);
+    samples = NULL;
+    return ok;
+}
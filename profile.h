@@ -0,0 +1,39 @@
+#ifndef LAB0_PROFILE_H
+#define LAB0_PROFILE_H
+
+#include <stdbool.h>
+
+/* Sampling CPU profiler.
+ *
+ * An ITIMER_PROF timer delivers SIGPROF at a fixed rate of consumed CPU
+ * time, and the handler stores the interrupted call stack, as unwound by
+ * backtrace(), into a buffer allocated when profiling starts.  Stacks are
+ * only symbolized when profiling stops, and written in the folded format of
+ * flamegraph.pl: one line per distinct stack, root first, frames separated
+ * by ';', followed by the number of samples.
+ */
+
+/* Deepest stack recorded; deeper ones are cut at the root end */
+#define PROFILE_DEPTH 48
+
+/* Samples kept; later ones are counted as dropped */
+#define PROFILE_MAX_SAMPLES (1 << 16)
+
+/* Default sampling rate, chosen not to beat with periodic work */
+#define PROFILE_HZ 997
+
+/* Start sampling at hz samples per second of CPU time.
+ * Return: false if already running or the timer could not be set up
+ */
+bool profile_start(int hz);
+
+/* Stop sampling and, unless file is NULL, write the folded stacks to it.
+ * *samples and *dropped, if not NULL, receive the number of samples written
+ * and of those that did not fit the buffer.
+ * Return: false if not running or the file could not be written
+ */
+bool profile_stop(const char *file, long *samples, long *dropped);
+
+bool profile_running(void);
+
+#endif /* LAB0_PROFILE_H */
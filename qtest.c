@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -19,6 +20,8 @@
 #include <time.h>
 #endif
 
+#include "dudect/complexity.h"
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
@@ -46,6 +49,7 @@ extern int show_entropy;
 
 #include "console.h"
 #include "report.h"
+#include "workload.h"
 
 /* Settable parameters */
 
@@ -163,21 +167,29 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
+static prng_t randstr_prng;
+
+/* Fill buf with a random string of MIN_RANDSTR_LEN to buf_size - 1 letters,
+ * and return its length.
  */
-static void fill_rand_string(char *buf, size_t buf_size)
+static size_t fill_rand_string(char *buf, size_t buf_size)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
-
-    uint64_t randstr_buf_64[MAX_RANDSTR_LEN] = {0};
-    randombytes((uint8_t *) randstr_buf_64, len * sizeof(uint64_t));
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[randstr_buf_64[n] % (sizeof(charset) - 1)];
+    assert(buf_size > MIN_RANDSTR_LEN);
+    size_t len = MIN_RANDSTR_LEN +
+                 prng_bounded(&randstr_prng, buf_size - MIN_RANDSTR_LEN);
+    prng_fill_string(&randstr_prng, buf, len, charset, sizeof(charset) - 1);
+    return len;
+}
 
-    buf[len] = '\0';
+/* dudect keeps its fixture queues allocated across samples, and cautious mode
+ * would walk all of their blocks on every free; it stays on for the rest
+ */
+static bool simulate(bool (*is_const)(void))
+{
+    set_fixture_mode(true);
+    bool ok = is_const();
+    set_fixture_mode(false);
+    return ok;
 }
 
 /* insertion */
@@ -188,8 +200,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
+        bool ok = simulate(pos == POS_TAIL ? is_insert_tail_const
+                                           : is_insert_head_const);
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -226,12 +238,14 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    size_t len = need_rand ? 0 : strlen(inserts);
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
+                len = fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            bool rval = pos == POS_TAIL
+                            ? q_insert_tail_n(current->q, inserts, len)
+                            : q_insert_head_n(current->q, inserts, len);
             if (rval) {
                 current->size++;
                 element_t *entry =
@@ -288,6 +302,36 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+/* Destination of removed strings, reused across removals.  Past removes[0],
+ * the buffer holds 'X' before every removal: the STRINGPAD bytes past
+ * string_length + 1 keep it for the overflow check, and queue_remove()
+ * restores it over the string it got, so that the next removal cannot pass
+ * on a terminator left by this one.
+ */
+static char *removes = NULL;
+static int removes_length = -1;
+static char removes_pad[STRINGPAD];
+
+static bool removes_setup(void)
+{
+    if (removes && removes_length == string_length)
+        return true;
+
+    free(removes);
+    removes = malloc(string_length + STRINGPAD + 1);
+    if (!removes) {
+        removes_length = -1;
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+    removes_length = string_length;
+    memset(removes_pad, 'X', sizeof(removes_pad));
+    memset(removes + 1, 'X', string_length + STRINGPAD - 1);
+    removes[string_length + STRINGPAD] = '\0';
+    return true;
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -300,8 +344,8 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
+        bool ok = simulate(pos == POS_TAIL ? is_remove_tail_const
+                                           : is_remove_head_const);
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -317,31 +361,12 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         return false;
     }
 
-    char *removes = malloc(string_length + STRINGPAD + 1);
-    if (!removes) {
-        report(1,
-               "INTERNAL ERROR.  Could not allocate space for removed strings");
-        return false;
-    }
-
-    char *checks = malloc(string_length + 1);
-    if (!checks) {
-        report(1,
-               "INTERNAL ERROR.  Could not allocate space for removed strings");
-        free(removes);
+    if (!removes_setup())
         return false;
-    }
 
     bool check = argc > 1;
     bool ok = true;
-    if (check) {
-        strncpy(checks, argv[1], string_length + 1);
-        checks[string_length] = '\0';
-    }
-
     removes[0] = '\0';
-    memset(removes + 1, 'X', string_length + STRINGPAD - 1);
-    removes[string_length + STRINGPAD] = '\0';
 
     if (!current || !current->size)
         report(3, "Warning: Calling remove %s on empty queue",
@@ -371,13 +396,11 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         /* Check whether padding in array removes are still initial value 'X'.
          * If there's other character in padding, it's overflowed.
          */
-        int i = string_length + 1;
-        while ((i < string_length + STRINGPAD) && (removes[i] == 'X'))
-            i++;
-        if (i != string_length + STRINGPAD) {
+        if (memcmp(removes + string_length + 1, removes_pad, STRINGPAD - 1)) {
             report(1,
                    "ERROR: copying of string in remove_head overflowed "
                    "destination buffer.");
+            memset(removes + string_length + 1, 'X', STRINGPAD - 1);
             ok = false;
         } else {
             report(2, "Removed %s from queue", removes);
@@ -394,16 +417,18 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (ok && check && strcmp(removes, checks)) {
-        report(1, "ERROR: Removed value %s != expected value %s", removes,
-               checks);
+    /* removes holds at most string_length characters, so this matches
+     * comparing against argv[1] truncated to that length
+     */
+    if (ok && check && strncmp(removes, argv[1], string_length)) {
+        report(1, "ERROR: Removed value %s != expected value %.*s", removes,
+               string_length, argv[1]);
         ok = false;
     }
+    memset(removes + 1, 'X', strnlen(removes, string_length));
 
     q_show(3);
 
-    free(removes);
-    free(checks);
     return ok && !error_check();
 }
 
@@ -674,6 +699,17 @@ static bool do_dm(int argc, char *argv[])
         return false;
     }
 
+    if (simulation) {
+        bool ok = simulate(is_delete_mid_const);
+        if (!ok) {
+            report(1,
+                   "ERROR: Probably not constant time or wrong implementation");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return ok;
+    }
+
     if (!current || !current->q) {
         report(3, "Warning: Try to access null queue");
         return false;
@@ -862,7 +898,7 @@ static bool do_merge(int argc, char *argv[])
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (!list_empty(&chain.head) && !list_is_singular(&chain.head)) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -1056,6 +1092,205 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+static bool do_complexity(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4) {
+        report(1, "%s takes 1-3 arguments", argv[0]);
+        return false;
+    }
+
+    int max_n = CX_MAX_N;
+    if (argc > 2 && (!get_int(argv[2], &max_n) || max_n < CX_MIN_N * 8)) {
+        report(1, "Invalid largest size '%s', need at least %d", argv[2],
+               CX_MIN_N * 8);
+        return false;
+    }
+
+    int bound = -1;
+    if (argc > 3 && (bound = cx_model_parse(argv[3])) < 0) {
+        report(1, "Unknown bound '%s', use 1, logn, n, nlogn or n2", argv[3]);
+        return false;
+    }
+
+    /* The fixtures are private queues; keep malloc failures and the O(n)
+     * frees of cautious mode out of the timings
+     */
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+    cx_result_t res;
+    bool ok = cx_classify(argv[1], max_n, &res);
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+
+    if (!ok) {
+        report_noreturn(1, "Cannot classify '%s'; operations:", argv[1]);
+        for (size_t i = 0; cx_op_name(i); i++)
+            report_noreturn(1, " %s", cx_op_name(i));
+        report(1, "");
+        return false;
+    }
+
+    double ns_per_cycle = 1e9 / cpucycles_hz();
+    report(2, "%10s %14s %14s", "n", "cycles", "ns");
+    for (int i = 0; i < res.points; i++)
+        report(2, "%10zu %14" PRId64 " %14.0f", res.n[i], res.cycles[i],
+               res.cycles[i] * ns_per_cycle);
+    for (int m = 0; m < CX_NMODELS; m++)
+        report(2, "%-12s R^2 %.4f", cx_model_name(m), res.r2[m]);
+    report(1, "%s: %s (confidence %.0f%%)", argv[1], cx_model_name(res.model),
+           res.confidence * 100);
+
+    if (bound >= 0 && res.model > bound) {
+        report(1, "ERROR: %s grows faster than %s", argv[1],
+               cx_model_name(bound));
+        return false;
+    }
+    return true;
+}
+
+static bool do_gen(int argc, char *argv[])
+{
+    wl_config_t cfg;
+    wl_defaults(&cfg);
+    for (int i = 1; i < argc; i++) {
+        if (!wl_parse(&cfg, argv[i])) {
+            report(1, "Invalid setting '%s'", argv[i]);
+            return false;
+        }
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling gen on null queue");
+        return false;
+    }
+    error_check();
+
+    /* Measure the queue rather than the harness: no injected malloc
+     * failures, and no walk of the allocation list on every free
+     */
+    bool ok = false;
+    wl_result_t res;
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+    if (exception_setup(false))
+        ok = wl_run(&cfg, current->q, &res);
+    exception_cancel();
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+    current->size = q_size(current->q);
+
+    if (!ok) {
+        report(1, "ERROR: Could not run workload");
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (int op = 0; op < WL_NOPS; op++) {
+        total += res.count[op];
+        if (res.count[op])
+            report(2, "%-8s %12" PRIu64, wl_op_name(op), res.count[op]);
+    }
+    report(1, "%" PRIu64 " operations in %.3f s, %.0f ops/s, queue size %d",
+           total, res.ns * 1e-9, res.ns ? total * 1e9 / res.ns : 0.0,
+           current->size);
+    if (res.empty)
+        report(2, "%" PRIu64 " operations found the queue empty", res.empty);
+    if (res.failed) {
+        report(1, "ERROR: %" PRIu64 " insertions failed", res.failed);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+/* Contents of the current queue, saved by "time -n" so that every run of a
+ * command that modifies it starts from the same queue
+ */
+static struct {
+    queue_contex_t *ctx;
+    char *chars;
+    size_t *lens;
+    size_t n;
+} saved;
+
+static bool time_save(int argc, char *argv[])
+{
+    static const char *const modifying[] = {
+        "ih", "it", "rh", "rt", "dm", "sort", "reverse", "swap", "dedup",
+        "ascend", "descend", "reverseK", "gen", NULL,
+    };
+
+    size_t i = 0;
+    while (modifying[i] && strcmp(argv[0], modifying[i]))
+        i++;
+    if (!modifying[i] || !current || !current->q)
+        return false;
+
+    size_t total = 0;
+    element_t *e;
+    list_for_each_entry(e, current->q, list)
+        total += e->len;
+    saved.ctx = current;
+    saved.n = q_size(current->q);
+    saved.chars = malloc(total ? total : 1);
+    saved.lens = malloc(saved.n ? saved.n * sizeof(size_t) : 1);
+    if (!saved.chars || !saved.lens) {
+        free(saved.chars);
+        free(saved.lens);
+        report(1, "Warning: Cannot save queue, runs will not be independent");
+        return false;
+    }
+
+    char *p = saved.chars;
+    i = 0;
+    list_for_each_entry(e, current->q, list) {
+        memcpy(p, e->value, e->len);
+        p += e->len;
+        saved.lens[i++] = e->len;
+    }
+    return true;
+}
+
+static bool time_restore(int argc, char *argv[])
+{
+    if (current != saved.ctx || !current->q) {
+        report(1, "ERROR: Queue changed, cannot restore it for the next run");
+        return false;
+    }
+
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+    element_t *e;
+    while ((e = q_remove_head(current->q, NULL, 0)))
+        q_release_element(e);
+    const char *p = saved.chars;
+    size_t i;
+    for (i = 0; i < saved.n; i++) {
+        if (!q_insert_tail_n(current->q, p, saved.lens[i]))
+            break;
+        p += saved.lens[i];
+    }
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+    current->size = i;
+    if (i < saved.n) {
+        report(1, "ERROR: Restored only %zu of %zu elements for the next run",
+               i, saved.n);
+        return false;
+    }
+    return true;
+}
+
+static bool time_discard(int argc, char *argv[])
+{
+    free(saved.chars);
+    free(saved.lens);
+    memset(&saved, 0, sizeof(saved));
+    return true;
+}
+
 // static bool do_shuffle(int argc, char *argv[])
 // {
 //     if (!current || !current->q) {
@@ -1110,6 +1345,14 @@ static void console_init()
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
     // ADD_COMMAND(shuffle, "Shuffle nodes in queue", "");
+    ADD_COMMAND(complexity,
+                "Fit how an operation's time grows with queue size, failing "
+                "if it grows faster than the bound",
+                "op [max_n [1|logn|n|nlogn|n2]]");
+    ADD_COMMAND(gen,
+                "Run a synthetic workload on the queue, e.g. ops=1e7 "
+                "mix=ih:40,rh:40,sort:1 keys=zipf:1.1 len=8..64 seed=1",
+                "[key=value ...]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
@@ -1167,6 +1410,9 @@ static bool q_quit(int argc, char *argv[])
     exception_cancel();
     set_cautious_mode(true);
 
+    free(removes);
+    removes = NULL;
+
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
@@ -1429,6 +1675,7 @@ int main(int argc, char *argv[])
      * with the Unix time.
      */
     srand(os_random(getpid() ^ getppid()));
+    prng_seed(&randstr_prng);
 
     q_init();
     init_cmd();
@@ -1450,6 +1697,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_repeat_hooks(time_save, time_restore, time_discard);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
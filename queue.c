@@ -5,22 +5,96 @@
 #include "report.h"
 
 #include "queue.h"
+#include "timeline.h"
+
+/* Compare values as byte strings: the common prefix with memcmp(), then the
+ * shorter one first.  For values without embedded null bytes this is the
+ * same order as strcmp().
+ */
+static inline int value_cmp(const element_t *a, const element_t *b)
+{
+    /* Most pairs differ within the first 8 bytes, which the prefix key
+     * decides without touching the strings
+     */
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    int r = memcmp(a->value, b->value, a->len < b->len ? a->len : b->len);
+    if (r)
+        return r;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/* Values of different length are never equal, which skips the memcmp() */
+static inline bool value_eq(const element_t *a, const element_t *b)
+{
+    return a->len == b->len && a->prefix == b->prefix &&
+           !memcmp(a->value, b->value, a->len);
+}
 
 static int cmp(const struct list_head *a, const struct list_head *b)
 {
-    const element_t *a_element = list_entry(a, element_t, list);
-    const element_t *b_element = list_entry(b, element_t, list);
-    return strcmp(a_element->value, b_element->value);
+    return value_cmp(list_entry(a, element_t, list),
+                     list_entry(b, element_t, list));
+}
+
+/* The list head handed out by q_new() is embedded in this container, which
+ * can track the size and the node q_delete_mid() removes: index
+ * (size - 1) / 2, or the head itself when empty.  Both move by at most one
+ * node on each insertion or removal at an end.  A queue starts untracked;
+ * the first q_delete_mid() establishes the tracking with one walk, and
+ * operations that rearrange nodes in bulk drop it again.
+ */
+typedef struct {
+    struct list_head head;
+    struct list_head *mid; /* NULL while untracked */
+    int size;              /* Only valid while mid is set */
+} queue_t;
+
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return list_entry(head, queue_t, head);
+}
+
+static inline void queue_untrack(struct list_head *head)
+{
+    to_queue(head)->mid = NULL;
+}
+
+/* Step the tracked middle node to next when step is set.  The choice is a
+ * load rather than a branch, since a branch on the parity of the size would
+ * be mispredicted on every other call and let the O(1) operations take
+ * data-dependent time.
+ */
+static inline void queue_step(queue_t *q, struct list_head *next, bool step)
+{
+    struct list_head *mid[2] = {q->mid, next};
+    q->mid = mid[step];
+}
+
+/* Count the nodes and find the middle one, tracking them from now on */
+static void queue_track(queue_t *q)
+{
+    struct list_head *head = &q->head, *mid = head, *node;
+    int size = 0;
+    list_for_each(node, head) {
+        if (!(size & 1))
+            mid = mid->next;
+        size++;
+    }
+    q->mid = mid;
+    q->size = size;
 }
 
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *new_head = malloc(sizeof(struct list_head));
-    if (!new_head)
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
         return NULL;
-    INIT_LIST_HEAD(new_head);
-    return new_head;
+    INIT_LIST_HEAD(&q->head);
+    q->mid = NULL;
+    q->size = 0;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
@@ -29,68 +103,111 @@ void q_free(struct list_head *head)
     if (!head)
         return;
 
-    struct list_head *pos, *safe;
-    list_for_each_safe(pos, safe, head) {
-        element_t *element = list_entry(pos, element_t, list);
-        q_release_element(element);
+    uint64_t span = timeline_begin();
+    struct list_head *pos, *safe, *ahead;
+    list_for_each_safe_prefetch(pos, safe, ahead, head) {
+        if (ahead != head)
+            list_prefetch(list_entry(ahead, element_t, list)->value);
+        q_release_element(list_entry(pos, element_t, list));
     }
-    free(head);
+    free(to_queue(head));
+    timeline_end("q_free", span);
 }
 
-/* Insert an element at head of queue */
-bool q_insert_head(struct list_head *head, char *s)
+static element_t *new_element(const char *s, size_t len)
 {
-    if (!head || !s)
-        return false;
     element_t *new_element = malloc(sizeof(element_t));
     if (!new_element)
-        return false;
-    size_t len = strlen(s) + 1;
-    new_element->value = malloc(len * sizeof(char));
+        return NULL;
+    new_element->value = malloc(len + 1);
     if (!new_element->value) {
-        q_release_element(new_element);
-        return false;
+        free(new_element);
+        return NULL;
     }
-    strncpy(new_element->value, s, len - 1);
-    new_element->value[len - 1] = '\0';
-    list_add(&new_element->list, head);
+    memcpy(new_element->value, s, len);
+    new_element->value[len] = '\0';
+    new_element->len = len;
+    new_element->prefix = 0;
+    for (size_t i = 0; i < len && i < sizeof(new_element->prefix); i++)
+        new_element->prefix |= (uint64_t) (uint8_t) s[i] << (56 - 8 * i);
+    return new_element;
+}
 
-    return true;
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return s && q_insert_head_n(head, s, strlen(s));
 }
 
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
+{
+    return s && q_insert_tail_n(head, s, strlen(s));
+}
+
+/* Insert an element holding len bytes of s at head of queue */
+bool q_insert_head_n(struct list_head *head, const char *s, size_t len)
 {
     if (!head || !s)
         return false;
-    element_t *new_element = malloc(sizeof(element_t));
-    if (!new_element)
-        return false;
-    size_t len = strlen(s) + 1;
-    new_element->value = malloc(len * sizeof(char));
-    if (!new_element->value) {
-        q_release_element(new_element);
+    element_t *element = new_element(s, len);
+    if (!element)
         return false;
+    list_add(&element->list, head);
+
+    /* An empty queue tracks the head, whose prev is now the new node */
+    queue_t *q = to_queue(head);
+    if (q->mid) {
+        queue_step(q, q->mid->prev, (q->size & 1) | !q->size);
+        q->size++;
     }
-    strncpy(new_element->value, s, len - 1);
-    new_element->value[len - 1] = '\0';
-    list_add_tail(&new_element->list, head);
+    return true;
+}
 
+/* Insert an element holding len bytes of s at tail of queue */
+bool q_insert_tail_n(struct list_head *head, const char *s, size_t len)
+{
+    if (!head || !s)
+        return false;
+    element_t *element = new_element(s, len);
+    if (!element)
+        return false;
+    list_add_tail(&element->list, head);
+
+    queue_t *q = to_queue(head);
+    if (q->mid) {
+        queue_step(q, q->mid->next, !(q->size & 1));
+        q->size++;
+    }
     return true;
 }
 
+/* Copy at most bufsize - 1 bytes of the value into sp, without the zero
+ * padding that strncpy() would add up to bufsize
+ */
+static inline void copy_value(char *sp, const element_t *e, size_t bufsize)
+{
+    size_t len = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, len);
+    sp[len] = '\0';
+}
+
 /* Remove an element from head of queue */
 element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 {
     if (!head || list_empty(head))
         return NULL;
     element_t *element = list_first_entry(head, element_t, list);
+    queue_t *q = to_queue(head);
+    /* The last node steps to its next, the head */
+    if (q->mid) {
+        queue_step(q, q->mid->next, !(q->size & 1) | (q->size == 1));
+        q->size--;
+    }
     list_del(&element->list);
 
-    if (sp && element->value && bufsize > 0) {
-        strncpy(sp, element->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    if (sp && element->value && bufsize > 0)
+        copy_value(sp, element, bufsize);
 
     return element;
 }
@@ -101,12 +218,15 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
     if (!head || list_empty(head))
         return NULL;
     element_t *element = list_last_entry(head, element_t, list);
+    queue_t *q = to_queue(head);
+    if (q->mid) {
+        queue_step(q, q->mid->prev, q->size & 1);
+        q->size--;
+    }
     list_del(&element->list);
 
-    if (sp && element->value && bufsize > 0) {
-        strncpy(sp, element->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    if (sp && element->value && bufsize > 0)
+        copy_value(sp, element, bufsize);
 
     return element;
 }
@@ -116,11 +236,22 @@ int q_size(struct list_head *head)
 {
     if (!head)
         return 0;
-    int len = 0;
-    struct list_head *li;
-    list_for_each(li, head)
-        len++;
-    return len;
+    queue_t *q = to_queue(head);
+    if (q->mid)
+        return q->size;
+
+    int size = 0;
+    struct list_head *node;
+    list_for_each(node, head)
+        size++;
+    return size;
+}
+
+/* Drop the tracking after the nodes were edited outside the q_*() API */
+void q_resync(struct list_head *head)
+{
+    if (head)
+        queue_untrack(head);
 }
 
 /* Delete the middle node in queue */
@@ -128,17 +259,16 @@ bool q_delete_mid(struct list_head *head)
 {
     if (!head || list_empty(head))
         return false;
-    struct list_head *fast = head->next->next;
-    struct list_head *slow = head->next;
-
-    while (fast != head && fast->next != head) {
-        slow = slow->next;
-        fast = fast->next->next;
-    }
-
-    list_del(slow);
-    element_t *element = list_entry(slow, element_t, list);
-    q_release_element(element);
+    queue_t *q = to_queue(head);
+    if (!q->mid)
+        queue_track(q);
+
+    struct list_head *mid = q->mid;
+    q->mid = mid->next;
+    queue_step(q, mid->prev, q->size & 1);
+    q->size--;
+    list_del(mid);
+    q_release_element(list_entry(mid, element_t, list));
     return true;
 }
 /* Delete all nodes that have duplicate string */
@@ -146,12 +276,13 @@ bool q_delete_dup(struct list_head *head)
 {
     if (!head || list_empty(head))
         return false;
+    queue_untrack(head);
     bool is_duplicate = false;
     element_t *entry = list_entry(head->next, element_t, list);
     element_t *safe = list_entry(entry->list.next, element_t, list);
 
     while (&entry->list != head) {
-        if (&safe->list != head && !strcmp(safe->value, entry->value)) {
+        if (&safe->list != head && value_eq(safe, entry)) {
             is_duplicate = true;
             list_del(&entry->list);
             q_release_element(entry);
@@ -171,6 +302,7 @@ void q_swap(struct list_head *head)
 {
     if (!head || list_empty(head))
         return;
+    queue_untrack(head);
     struct list_head *first = head->next;
     while (first != head && first->next != head) {
         list_move(first, first->next);
@@ -183,6 +315,7 @@ void q_reverse(struct list_head *head)
 {
     if (!head || list_empty(head))
         return;
+    queue_untrack(head);
     struct list_head *curr = head;
     struct list_head *tmp;
 
@@ -200,6 +333,7 @@ void q_reverseK(struct list_head *head, int k)
     if (!head || list_empty(head) || head->next == head->prev)
         return;
     int len = q_size(head);
+    queue_untrack(head);
     LIST_HEAD(result);
     for (int i = 0; i < len; i += k) {
         LIST_HEAD(tmp);
@@ -240,7 +374,7 @@ struct list_head *mergeTwoLists(struct list_head *left, struct list_head *right)
         const element_t *left_element = list_entry(left, element_t, list);
         const element_t *right_element = list_entry(right, element_t, list);
         struct list_head *get;
-        if (strcmp(left_element->value, right_element->value) > 0) {
+        if (value_cmp(left_element, right_element) > 0) {
             get = right;
             right = right->next;
         } else {
@@ -287,100 +421,63 @@ struct list_head *merge_sort(struct list_head *head)
 
     return mergeTwoLists(left_sorted, right_sorted);
 }
-/* Remove every node which has a node with a strictly less value anywhere to
- * the right side of it */
-int q_ascend(struct list_head *head)
+/* Walk from the tail, relinking only the kept nodes.  Deleted ones are
+ * released on the spot, while they are still in the cache, and never
+ * unlinked one by one.
+ */
+int q_filter(struct list_head *head,
+             bool (*keep)(const element_t *node, const element_t *kept))
 {
     if (!head || list_empty(head))
         return 0;
-    if (head->next == head->prev)
-        return 1;
-
-    element_t *curr = list_entry(head->prev, element_t, list);
-    const char *min_value = curr->value;
 
-    while (&curr->list != head) {
-        element_t *next = list_entry(curr->list.prev, element_t, list);
-        if (strcmp(curr->value, min_value) > 0) {
-            list_del(&curr->list);
-            q_release_element(curr);
+    struct list_head *kept = head->prev, *node = kept->prev;
+    int count = 1;
+    bool dropped = false;
+    while (node != head) {
+        struct list_head *prev = node->prev;
+        element_t *e = list_entry(node, element_t, list);
+        if (keep(e, list_entry(kept, element_t, list))) {
+            node->next = kept;
+            kept->prev = node;
+            kept = node;
+            count++;
         } else {
-            min_value = curr->value;
+            q_release_element(e);
+            dropped = true;
         }
-        curr = next;
+        node = prev;
     }
-    return q_size(head);
+    head->next = kept;
+    kept->prev = head;
+    if (dropped)
+        queue_untrack(head);
+    return count;
 }
 
-/* Remove every node which has a node with a strictly greater value anywhere to
- * the right side of it */
-int q_descend(struct list_head *head)
+static bool keep_ascend(const element_t *node, const element_t *kept)
 {
-    if (!head || list_empty(head))
-        return 0;
-    if (head->next == head->prev)
-        return 1;
-
-    element_t *curr = list_entry(head->prev, element_t, list);
-    const char *max_value = curr->value;
-
-    while (&curr->list != head) {
-        element_t *prev = list_entry(curr->list.prev, element_t, list);
-        if (strcmp(curr->value, max_value) < 0) {
-            list_del(&curr->list);
-            q_release_element(curr);
-        } else {
-            max_value = curr->value;
-        }
-        curr = prev;
-    }
-    return q_size(head);
+    return value_cmp(node, kept) <= 0;
 }
 
-void mergeTwoLists_2(struct list_head *left,
-                     struct list_head *right,
-                     bool descend)
+static bool keep_descend(const element_t *node, const element_t *kept)
 {
-    if (list_empty(left) && list_empty(right))
-        return;
-
-    LIST_HEAD(result);
-    while (!list_empty(left) && !list_empty(right)) {
-        element_t *left_element = list_first_entry(left, element_t, list);
-        element_t *right_element = list_first_entry(right, element_t, list);
-        int cmp_result = strcmp(left_element->value, right_element->value);
-        if ((descend && cmp_result < 0) || (!descend && cmp_result > 0))
-            list_move_tail(&right_element->list, &result);
-        else
-            list_move_tail(&left_element->list, &result);
-    }
-    list_splice_tail_init(left, &result);
-    list_splice_tail_init(right, &result);
-    list_splice(&result, left);
+    return value_cmp(node, kept) >= 0;
 }
 
-/* Merge all the queues into one sorted queue, which is in ascending/descending
- * order */
-int q_merge(struct list_head *head, bool descend)
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
 {
-    if (!head || list_empty(head))
-        return 0;
-    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
-    int result = q_size(first->q);
-
-    if (list_is_singular(head))
-        return result;
-
-    queue_contex_t *second =
-        list_entry(first->chain.next, queue_contex_t, chain);
-    while (&second->chain != head) {
-        result += q_size(second->q);
-        mergeTwoLists_2(first->q, second->q, descend);
-        second = list_entry(second->chain.next, queue_contex_t, chain);
-    }
-    return result;
+    return q_filter(head, keep_ascend);
 }
 
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    return q_filter(head, keep_descend);
+}
 
 void q_shuffle(struct list_head *head)
 {
@@ -403,142 +500,109 @@ void q_shuffle(struct list_head *head)
         char *temp = old_element->value;
         old_element->value = new_element->value;
         new_element->value = temp;
+        size_t temp_len = old_element->len;
+        old_element->len = new_element->len;
+        new_element->len = temp_len;
+        uint64_t temp_prefix = old_element->prefix;
+        old_element->prefix = new_element->prefix;
+        new_element->prefix = temp_prefix;
     }
 
     rebuild_list_link(head);
 }
 
-static struct list_head *merge(struct list_head *a, struct list_head *b)
-{
-    struct list_head *head = NULL, **tail = &head;
-
-    for (;;) {
-        /* if equal, take 'a' -- important for sort stability */
-        if (cmp(a, b) <= 0) {
-            *tail = a;
-            tail = &a->next;
-            a = a->next;
-            if (!a) {
-                *tail = b;
-                break;
-            }
-        } else {
-            *tail = b;
-            tail = &b->next;
-            b = b->next;
-            if (!b) {
-                *tail = a;
-                break;
-            }
-        }
-    }
-    return head;
-}
-
-static void merge_final(struct list_head *head,
-                        struct list_head *a,
-                        struct list_head *b)
-{
-    struct list_head *tail = head;
-    // int count = 0;
-
-    for (;;) {
-        /* if equal, take 'a' -- important for sort stability */
-        if (cmp(a, b) <= 0) {
-            tail->next = a;
-            a->prev = tail;
-            tail = a;
-            a = a->next;
-            if (!a)
-                break;
-        } else {
-            tail->next = b;
-            b->prev = tail;
-            tail = b;
-            b = b->next;
-            if (!b) {
-                b = a;
-                break;
-            }
-        }
-    }
-
-    /* Finish linking remainder of list b on to tail */
-    tail->next = b;
-    do {
-        // if (__glibc_unlikely(!++count)) {
-        //     element_t *b_element = list_entry(a, element_t, list);
-        //     strcmp(b_element->value, b_element->value);
-        // }
-        b->prev = tail;
-        tail = b;
-        b = b->next;
-    } while (b);
-
-    /* And the final links to make a circular doubly-linked list */
-    tail->next = head;
-    head->prev = tail;
-}
-
-void list_sort(struct list_head *head)
-{
-    struct list_head *list = head->next, *pending = NULL;
-    size_t count = 0; /* Count of pending */
-
-    if (list == head->prev) /* Zero or one elements */
-        return;
-
-    head->prev->next = NULL;
-
-    do {
-        size_t bits;
-        struct list_head **tail = &pending;
-
-        /* Find the least-significant clear bit in count */
-        for (bits = count; bits & 1; bits >>= 1)
-            tail = &(*tail)->prev;
-        /* Do the indicated merge */
-        if (__glibc_likely(bits)) {
-            struct list_head *a = *tail, *b = a->prev;
-
-            a = merge(b, a);
-            /* Install the merged result in place of the inputs */
-            a->prev = b->prev;
-            *tail = a;
-        }
-
-        /* Move one element from input list to pending */
-        list->prev = pending;
-        pending = list;
-        list = list->next;
-        pending->next = NULL;
-        count++;
-    } while (list);
-
-    /* End of input; merge together all the pending lists. */
-    list = pending;
-    pending = pending->prev;
-    for (;;) {
-        struct list_head *next = pending->prev;
-
-        if (!next)
-            break;
-        list = merge(pending, list);
-        pending = next;
-    }
-    /* The final merge, rebuilding prev links */
-    merge_final(head, pending, list);
-}
+/* Natural merge sort in the style of TimSort, on the singly linked view of
+ * the list (next pointers, NULL-terminated).  The input is cut into runs
+ * that are already ascending, or descending and reversed in place, so
+ * sorted or reversed input is a single run and costs O(n) comparisons.
+ * Runs are kept on a stack whose lengths grow at least like the Fibonacci
+ * numbers, which bounds the merge cost by O(n log n) and the stack depth by
+ * MAX_RUNS.  Merges switch to galloping when one side keeps winning,
+ * trading a linear scan of comparisons for an exponential search and
+ * splicing the whole streak at once.
+ *
+ * Runs keep valid prev links, and the final merge rebuilds them as it goes,
+ * so no separate pass over the sorted list is needed.
+ */
+
+/* Kernels are generated from sort_impl.h once per direction, with the
+ * comparison inlined.  Descending order compares with the operands swapped,
+ * which keeps equal elements in their original order.
+ */
+
+#define MIN_RUN 8
+#define MIN_GALLOP 7
+#define MAX_RUNS 85
+
+typedef struct {
+    struct list_head *head;
+    struct list_head *tail; /* Only maintained until the run is merged */
+    size_t len;
+} run_t;
+
+typedef struct {
+    run_t runs[MAX_RUNS];
+    int n;
+    size_t min_gallop;
+} sort_state_t;
+
+#define SORT_NAME asc
+#define SORT_CMP(a, b) cmp(a, b)
+#include "sort_impl.h"
+
+#define SORT_NAME desc
+#define SORT_CMP(a, b) cmp(b, a)
+#include "sort_impl.h"
 
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
     if (!head || list_empty(head))
         return;
+    queue_untrack(head);
     // head->prev->next = NULL;
     // head->next = merge_sort(head->next);
     // rebuild_list_link(head);
-    list_sort(head);
+    uint64_t span = timeline_begin();
+    if (descend)
+        list_sort_desc(head);
+    else
+        list_sort_asc(head);
+    timeline_end("q_sort", span);
+}
+
+void mergeTwoLists_2(struct list_head *left,
+                     struct list_head *right,
+                     bool descend)
+{
     if (descend)
-        q_reverse(head);
+        merge_lists_desc(left, right);
+    else
+        merge_lists_asc(left, right);
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
+    int result = q_size(first->q);
+
+    if (list_is_singular(head))
+        return result;
+
+    queue_contex_t *second =
+        list_entry(first->chain.next, queue_contex_t, chain);
+    uint64_t span = timeline_begin();
+    while (&second->chain != head) {
+        result += q_size(second->q);
+        mergeTwoLists_2(first->q, second->q, descend);
+        queue_untrack(first->q);
+        queue_untrack(second->q);
+        second = list_entry(second->chain.next, queue_contex_t, chain);
+    }
+    timeline_end("q_merge", span);
+    return result;
 }
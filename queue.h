@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
@@ -16,12 +17,19 @@
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
+ * @len: length of @value, excluding the terminating null byte
+ * @prefix: first 8 bytes of @value as a big-endian integer, zero-padded
  * @list: node of a doubly-linked list
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed.  It is always
+ * null-terminated, but may also contain null bytes within its @len bytes.
+ * Comparing @prefix orders elements like comparing their first 8 bytes, so
+ * most comparisons need not dereference @value.
  */
 typedef struct {
     char *value;
+    size_t len;
+    uint64_t prefix;
     struct list_head list;
 } element_t;
 
@@ -44,6 +52,13 @@ typedef struct {
 /**
  * q_new() - Create an empty queue whose next and prev pointer point to itself
  *
+ * Once q_delete_mid() has been called on a queue, the queue tracks its size
+ * and its middle node until an operation that rearranges nodes in bulk.  The
+ * nodes of a queue must therefore be added, removed and moved only through
+ * the q_*() functions; a caller that edits the list directly, for example
+ * with list_move(), must call q_resync() afterwards, or q_size() and
+ * q_delete_mid() work on stale state.
+ *
  * Return: NULL for allocation failed
  */
 struct list_head *q_new();
@@ -78,6 +93,30 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_n() - Insert an element holding len bytes of s in the head
+ * @head: header of queue
+ * @s: bytes would be inserted
+ * @len: number of bytes in s
+ *
+ * Like q_insert_head(), but the length is given by the caller, so s is not
+ * scanned for its end and may contain null bytes.  The stored value is
+ * null-terminated after its len bytes.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_n(struct list_head *head, const char *s, size_t len);
+
+/**
+ * q_insert_tail_n() - Insert an element holding len bytes of s at the tail
+ * @head: header of queue
+ * @s: bytes would be inserted
+ * @len: number of bytes in s
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_n(struct list_head *head, const char *s, size_t len);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -86,6 +125,9 @@ bool q_insert_tail(struct list_head *head, char *s);
  *
  * If sp is non-NULL and an element is removed, copy the removed string to *sp
  * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The full value and its length stay available through the returned
+ * element, so callers that take ownership of it can pass a NULL sp and skip
+ * the copy.
  *
  * NOTE: "remove" is different from "delete"
  * The space used by the list element and the string should not be freed.
@@ -128,6 +170,15 @@ static inline void q_release_element(element_t *e)
  */
 int q_size(struct list_head *head);
 
+/**
+ * q_resync() - Drop what the queue tracks about its nodes
+ * @head: header of queue
+ *
+ * Call after adding, removing or moving nodes without the q_*() functions.
+ * The next q_delete_mid() tracks the queue again, with one walk.
+ */
+void q_resync(struct list_head *head);
+
 /**
  * q_delete_mid() - Delete the middle node in queue
  * @head: header of queue
@@ -230,6 +281,22 @@ int q_ascend(struct list_head *head);
  */
 int q_descend(struct list_head *head);
 
+/**
+ * q_filter() - Delete nodes in one pass from tail to head, keeping each node
+ * that the predicate accepts against the nearest kept node to its right.
+ * @head: header of queue
+ * @keep: predicate called as keep(node, kept); the tail is always kept
+ *
+ * q_ascend() keeps a node whose value is at most the kept one, q_descend()
+ * one whose value is at least the kept one.  Other monotonic-stack filters
+ * fit the same shape.  Each deleted element is released as soon as the walk
+ * reaches it, before the nodes to its left are visited.
+ *
+ * Return: the number of elements in queue after performing operation
+ */
+int q_filter(struct list_head *head,
+             bool (*keep)(const element_t *node, const element_t *kept));
+
 /**
  * q_merge() - Merge all the queues into one sorted queue, which is in
  * ascending/descending order.
@@ -28,6 +28,10 @@
 #define _GNU_SOURCE
 #endif
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -272,7 +276,8 @@ static int bsd_randombytes(void *buf, size_t n)
 }
 #endif
 
-int randombytes(uint8_t *buf, size_t n)
+/* Read n bytes of seed material from the operating system */
+static int os_randombytes(uint8_t *buf, size_t n)
 {
 #if defined(__linux__) || defined(__GNU__)
 #if defined(USE_GLIBC)
@@ -291,3 +296,196 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* randombytes() serves a per-thread pool of ChaCha20 keystream, so that a
+ * system call is only needed once per thread to seed the key.  The pool is
+ * refilled 1 KiB at a time; the first 32 bytes of each refill replace the
+ * key and every byte is wiped once handed out ("fast key erasure"), which
+ * keeps earlier output unrecoverable from the current state.
+ */
+
+#define CHACHA_KEY_SIZE 32
+#define CHACHA_BLOCK_SIZE 64
+#define POOL_SIZE (16 * CHACHA_BLOCK_SIZE)
+
+typedef struct {
+    uint32_t key[CHACHA_KEY_SIZE / 4];
+    uint8_t pool[POOL_SIZE];
+    size_t avail;      /* Unused bytes at the end of pool */
+    unsigned fork_gen; /* Value of fork_gen when seeded */
+    bool seeded;
+} rng_state_t;
+
+static __thread rng_state_t rng;
+
+/* Bumped in the child after fork(), so that parent and child never share
+ * a keystream
+ */
+static unsigned fork_gen = 0;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void rng_atfork_child(void)
+{
+    fork_gen++;
+}
+
+static void rng_register_atfork(void)
+{
+    pthread_atfork(NULL, NULL, rng_atfork_child);
+}
+
+static inline uint32_t load32_le(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+static inline void store32_le(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    do {                         \
+        a += b;                  \
+        d = ROTL32(d ^ a, 16);   \
+        c += d;                  \
+        b = ROTL32(b ^ c, 12);   \
+        a += b;                  \
+        d = ROTL32(d ^ a, 8);    \
+        c += d;                  \
+        b = ROTL32(b ^ c, 7);    \
+    } while (0)
+
+/* One ChaCha20 block (RFC 8439) with an all-zero nonce */
+static void chacha20_block(const uint32_t key[8], uint32_t counter,
+                           uint8_t *out)
+{
+    const uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574, key[0], key[1],
+        key[2],     key[3],     key[4],     key[5],     key[6], key[7],
+        counter,    0,          0,          0,
+    };
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++)
+        store32_le(out + 4 * i, x[i] + in[i]);
+}
+
+static void rng_refill(void)
+{
+    for (int i = 0; i < POOL_SIZE / CHACHA_BLOCK_SIZE; i++)
+        chacha20_block(rng.key, i, rng.pool + i * CHACHA_BLOCK_SIZE);
+
+    for (int i = 0; i < CHACHA_KEY_SIZE / 4; i++)
+        rng.key[i] = load32_le(rng.pool + 4 * i);
+    memset(rng.pool, 0, CHACHA_KEY_SIZE);
+    rng.avail = POOL_SIZE - CHACHA_KEY_SIZE;
+}
+
+static int rng_seed(void)
+{
+    uint8_t seed[CHACHA_KEY_SIZE];
+
+    pthread_once(&atfork_once, rng_register_atfork);
+    if (os_randombytes(seed, sizeof(seed)) != 0)
+        return -1;
+    for (int i = 0; i < CHACHA_KEY_SIZE / 4; i++)
+        rng.key[i] = load32_le(seed + 4 * i);
+    memset(seed, 0, sizeof(seed));
+
+    /* Discard anything produced under the previous key */
+    memset(rng.pool, 0, sizeof(rng.pool));
+    rng.avail = 0;
+    rng.fork_gen = fork_gen;
+    rng.seeded = true;
+    return 0;
+}
+
+int randombytes(uint8_t *buf, size_t n)
+{
+    if (!rng.seeded || rng.fork_gen != fork_gen) {
+        if (rng_seed() != 0)
+            return -1;
+    }
+
+    while (n > 0) {
+        if (!rng.avail)
+            rng_refill();
+        size_t chunk = n < rng.avail ? n : rng.avail;
+        uint8_t *src = rng.pool + POOL_SIZE - rng.avail;
+        memcpy(buf, src, chunk);
+        memset(src, 0, chunk);
+        rng.avail -= chunk;
+        buf += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+void prng_seed(prng_t *p)
+{
+    /* An all-zero state would only ever produce zeros */
+    do
+        randombytes((uint8_t *) p->s, sizeof(p->s));
+    while (!(p->s[0] | p->s[1] | p->s[2] | p->s[3]));
+}
+
+void prng_seed_u64(prng_t *p, uint64_t seed)
+{
+    /* splitmix64 never yields four zero outputs in a row */
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = seed += 0x9e3779b97f4a7c15;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        p->s[i] = z ^ (z >> 31);
+    }
+}
+
+#define PRNG_BATCH 16
+
+void prng_fill_string(prng_t *p,
+                      char *buf,
+                      size_t len,
+                      const char *charset,
+                      uint32_t n)
+{
+    uint32_t lanes[PRNG_BATCH * 2];
+    char *dst = buf;
+    size_t left = len;
+
+    while (left > 0) {
+        size_t chunk = left < PRNG_BATCH * 2 ? left : PRNG_BATCH * 2;
+        for (size_t i = 0; i < (chunk + 1) / 2; i++) {
+            uint64_t r = prng_next(p);
+            lanes[2 * i] = r;
+            lanes[2 * i + 1] = r >> 32;
+        }
+        /* Map each 32-bit lane to [0, n) by multiply-shift.  The bias is
+         * below n / 2^32, and the loop has no data-dependent branches, so
+         * the compiler can vectorize it.
+         */
+        for (size_t i = 0; i < chunk; i++)
+            dst[i] = charset[((uint64_t) lanes[i] * n) >> 32];
+        dst += chunk;
+        left -= chunk;
+    }
+    *dst = '\0';
+}
@@ -13,6 +13,65 @@ static inline uint8_t randombit(void)
     return ret & 1;
 }
 
+/* xoshiro256** by David Blackman and Sebastiano Vigna, see:
+ * <https://prng.di.unimi.it/xoshiro256starstar.c>
+ * Fast and statistically strong, but not cryptographic: meant for bulk
+ * test data rather than anything an adversary may try to predict.
+ */
+typedef struct {
+    uint64_t s[4];
+} prng_t;
+
+/* Seed from randombytes() */
+void prng_seed(prng_t *p);
+
+/* Seed deterministically, expanding seed with splitmix64 */
+void prng_seed_u64(prng_t *p, uint64_t seed);
+
+static inline uint64_t prng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t prng_next(prng_t *p)
+{
+    uint64_t *s = p->s;
+    const uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+
+    return result;
+}
+
+/* Uniform value in [0, range), by Daniel Lemire's multiply-and-reject
+ * method, see: <https://arxiv.org/abs/1805.10941>
+ */
+static inline uint32_t prng_bounded(prng_t *p, uint32_t range)
+{
+    uint64_t m = (prng_next(p) >> 32) * range;
+    if ((uint32_t) m < range) {
+        uint32_t threshold = -range % range;
+        while ((uint32_t) m < threshold)
+            m = (prng_next(p) >> 32) * range;
+    }
+    return m >> 32;
+}
+
+/* Fill buf with len characters drawn uniformly from charset[0..n), and
+ * null-terminate it.  buf must hold len + 1 bytes.
+ */
+void prng_fill_string(prng_t *p,
+                      char *buf,
+                      size_t len,
+                      const char *charset,
+                      uint32_t n);
+
 #if INTPTR_MAX == INT64_MAX
 #define M_INTPTR_SHIFT (3)
 #elif INTPTR_MAX == INT32_MAX
@@ -1,3 +1,6 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -10,6 +13,7 @@
 #include <unistd.h>
 
 #include "report.h"
+#include "timeline.h"
 #include "web.h"
 
 #define MAX(a, b) ((a) < (b) ? (b) : (a))
@@ -25,6 +29,201 @@ static void init_files(FILE *efile, FILE *vfile)
     verbfile = vfile;
 }
 
+/* Output is batched: messages accumulate in large, fully buffered stdio
+ * streams and reach each sink with a single write() when report_flush() is
+ * called at command boundaries.  Sharing the stdio buffer keeps the ordering
+ * with plain printf() output intact.
+ */
+#define OUTBUF_SIZE (64 * 1024)
+static char verb_outbuf[OUTBUF_SIZE];
+static char log_outbuf[OUTBUF_SIZE];
+
+/* Must run before anything is written to stdout */
+static void __attribute__((constructor)) init_outbuf(void)
+{
+    setvbuf(stdout, verb_outbuf, _IOFBF, OUTBUF_SIZE);
+}
+
+/* Asynchronous log writer.
+ * The interpreter thread appends log text to a single-producer,
+ * single-consumer byte ring and a background thread drains it with large
+ * coalesced write() calls, so logging stays out of command latency.
+ * head and tail only ever grow; their difference is the fill level.
+ * An idle writer blocks on a condition variable, and the producer takes the
+ * lock to signal it only while it is marked as waiting.
+ */
+#define LOG_RING_SIZE (1 << 20) /* Must be a power of 2 */
+
+int log_async = 0;
+
+static struct {
+    char buf[LOG_RING_SIZE];
+    size_t head; /* Advanced by the producer */
+    size_t tail; /* Advanced by the writer thread */
+    int fd;
+    bool sync;
+    bool stop;
+    bool running;
+    bool waiting; /* Writer is blocked, or about to block, on wake */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+} log_ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/* Block until the producer has pushed past tail or asked to stop.  waiting
+ * is set before head and stop are checked again, and the producer sets
+ * those before checking waiting, so one of the two sees the other.
+ */
+static void log_writer_wait(size_t tail)
+{
+    pthread_mutex_lock(&log_ring.lock);
+    __atomic_store_n(&log_ring.waiting, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&log_ring.head, __ATOMIC_SEQ_CST) == tail &&
+           !__atomic_load_n(&log_ring.stop, __ATOMIC_SEQ_CST))
+        pthread_cond_wait(&log_ring.wake, &log_ring.lock);
+    __atomic_store_n(&log_ring.waiting, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&log_ring.lock);
+}
+
+static void log_writer_wake(void)
+{
+    if (!__atomic_load_n(&log_ring.waiting, __ATOMIC_SEQ_CST))
+        return;
+    pthread_mutex_lock(&log_ring.lock);
+    pthread_cond_signal(&log_ring.wake);
+    pthread_mutex_unlock(&log_ring.lock);
+}
+
+static void *log_writer(void *arg)
+{
+    size_t tail = log_ring.tail;
+    timeline_thread_name("log writer");
+
+    for (;;) {
+        /* Observe stop before head, so a final batch is never missed */
+        bool stop = __atomic_load_n(&log_ring.stop, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (stop)
+                break;
+            log_writer_wait(tail);
+            continue;
+        }
+
+        uint64_t span = timeline_begin();
+        while (tail != head) {
+            size_t off = tail & (LOG_RING_SIZE - 1);
+            size_t n = head - tail;
+            if (n > LOG_RING_SIZE - off)
+                n = LOG_RING_SIZE - off;
+            ssize_t written = write(log_ring.fd, log_ring.buf + off, n);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                /* Unrecoverable: discard instead of stalling the producer */
+                tail = head;
+                break;
+            }
+            tail += written;
+        }
+        if (log_ring.sync)
+            fdatasync(log_ring.fd);
+        timeline_end("log_write", span);
+        __atomic_store_n(&log_ring.tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void log_ring_push(const char *msg, size_t len)
+{
+    size_t head = log_ring.head;
+    while (len) {
+        size_t used = head - __atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE);
+        size_t space = LOG_RING_SIZE - used;
+        if (!space) {
+            /* Writer is behind; never drop log text */
+            sched_yield();
+            continue;
+        }
+        size_t off = head & (LOG_RING_SIZE - 1);
+        size_t n = len;
+        if (n > space)
+            n = space;
+        if (n > LOG_RING_SIZE - off)
+            n = LOG_RING_SIZE - off;
+        memcpy(log_ring.buf + off, msg, n);
+        head += n;
+        __atomic_store_n(&log_ring.head, head, __ATOMIC_SEQ_CST);
+        log_writer_wake();
+        msg += n;
+        len -= n;
+    }
+}
+
+/* Drain pending log text and join the writer thread */
+static void log_async_stop(void)
+{
+    if (!log_ring.running)
+        return;
+    __atomic_store_n(&log_ring.stop, true, __ATOMIC_SEQ_CST);
+    log_writer_wake();
+    pthread_join(log_ring.thread, NULL);
+    log_ring.running = false;
+    log_ring.stop = false;
+    log_ring.head = log_ring.tail = 0;
+}
+
+static void log_async_start(void)
+{
+    static bool registered = false;
+
+    if (!logfile || log_ring.running)
+        return;
+
+    /* Text already buffered by stdio must precede the ring contents */
+    fflush(logfile);
+    log_ring.fd = fileno(logfile);
+    log_ring.sync = log_async > 1;
+    if (pthread_create(&log_ring.thread, NULL, log_writer, NULL)) {
+        log_async = 0;
+        return;
+    }
+    log_ring.running = true;
+
+    if (!registered) {
+        atexit(log_async_stop);
+        registered = true;
+    }
+}
+
+void log_async_update(int oldval)
+{
+    /* Restart as well, since the fdatasync() setting may have changed */
+    log_async_stop();
+    if (log_async)
+        log_async_start();
+}
+
+/* Append text to the log file, through the writer thread when enabled */
+static void log_write(const char *msg, size_t len)
+{
+    if (log_ring.running)
+        log_ring_push(msg, len);
+    else
+        fwrite(msg, 1, len, logfile);
+}
+
+void report_flush(void)
+{
+    if (verbfile)
+        fflush(verbfile);
+    if (logfile)
+        fflush(logfile);
+}
+
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
 
 static volatile int ret = 0;
@@ -32,6 +231,8 @@ static volatile int ret = 0;
 /* Default fatal function */
 static void default_fatal_fun()
 {
+    log_async_stop();
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
     if (logfile)
         fputs(fail_buf, logfile);
@@ -47,8 +248,17 @@ void set_verblevel(int level)
 
 bool set_logfile(const char *file_name)
 {
+    log_async_stop();
+    if (logfile)
+        fclose(logfile);
     logfile = fopen(file_name, "w");
-    return logfile != NULL;
+    if (!logfile)
+        return false;
+
+    setvbuf(logfile, log_outbuf, _IOFBF, OUTBUF_SIZE);
+    if (log_async)
+        log_async_start();
+    return true;
 }
 
 void report_event(message_t msg, char *fmt, ...)
@@ -79,6 +289,7 @@ void report_event(message_t msg, char *fmt, ...)
     va_end(ap);
 
     if (logfile) {
+        log_async_stop();
         va_start(ap, fmt);
         fprintf(logfile, "Error: ");
         vfprintf(logfile, fmt, ap);
@@ -86,6 +297,7 @@ void report_event(message_t msg, char *fmt, ...)
         fflush(logfile);
         va_end(ap);
         fclose(logfile);
+        logfile = NULL;
     }
 
     if (fatal) {
@@ -97,65 +309,62 @@ void report_event(message_t msg, char *fmt, ...)
 
 #define BUF_SIZE 4096
 extern int web_connfd;
-void report(int level, char *fmt, ...)
+
+/* Format the message once and hand the same bytes to every sink */
+static void report_va(int level, bool newline, char *fmt, va_list ap)
 {
     if (!verbfile)
         init_files(stdout, stdout);
 
+    if (level > verblevel)
+        return;
+
     char buffer[BUF_SIZE];
-    if (level <= verblevel) {
-        va_list ap;
-        va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
-        va_end(ap);
+    char *msg = buffer;
+    va_list aq;
+    va_copy(aq, ap);
+    /* Keep room for the return character */
+    int len = vsnprintf(buffer, BUF_SIZE - 1, fmt, aq);
+    va_end(aq);
+    if (len < 0)
+        return;
 
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fprintf(logfile, "\n");
-            fflush(logfile);
-            va_end(ap);
-        }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
+    if (len >= BUF_SIZE - 1) {
+        msg = malloc(len + 2);
+        if (!msg)
+            return;
+        vsnprintf(msg, len + 1, fmt, ap);
     }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+
+    if (newline) {
+        msg[len++] = '\n';
+        msg[len] = '\0';
     }
-}
 
-void report_noreturn(int level, char *fmt, ...)
-{
-    if (!verbfile)
-        init_files(stdout, stdout);
+    fwrite(msg, 1, len, verbfile);
+    if (logfile)
+        log_write(msg, len);
+    if (web_connfd)
+        web_send(web_connfd, msg);
 
-    char buffer[BUF_SIZE];
-    if (level <= verblevel) {
-        va_list ap;
-        va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
-        va_end(ap);
+    if (msg != buffer)
+        free(msg);
+}
 
-        if (logfile) {
-            va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fflush(logfile);
-            va_end(ap);
-        }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
-    }
+void report(int level, char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    report_va(level, true, fmt, ap);
+    va_end(ap);
+}
 
-    if (web_connfd)
-        web_send(web_connfd, buffer);
+void report_noreturn(int level, char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    report_va(level, false, fmt, ap);
+    va_end(ap);
 }
 
 /* Functions denoting failures */
@@ -167,6 +376,8 @@ static void fail_fun(const char *format, const char *msg)
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
     /* Use write to avoid any buffering issues */
+    log_async_stop();
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
 
     if (logfile) {
@@ -298,6 +509,16 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+void get_mem_usage(mem_usage_t *usage)
+{
+    usage->allocate_cnt = allocate_cnt;
+    usage->allocate_bytes = allocate_bytes;
+    usage->free_cnt = free_cnt;
+    usage->free_bytes = free_bytes;
+    usage->peak_bytes = peak_bytes;
+    usage->current_bytes = current_bytes;
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
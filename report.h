@@ -14,6 +14,14 @@ typedef enum { MSG_WARN, MSG_ERROR, MSG_FATAL, N_MSG } message_t;
 
 bool set_logfile(const char *file_name);
 
+/* Write the log file from a background thread.
+ * 0: off, 1: on, 2: on and fdatasync() after every batch
+ */
+extern int log_async;
+
+/* Apply a new value of log_async */
+void log_async_update(int oldval);
+
 extern int verblevel;
 void set_verblevel(int level);
 
@@ -26,6 +34,9 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Write out buffered report output.  Called at command boundaries */
+void report_flush(void);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, const char *fun_name);
 
@@ -44,6 +55,18 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Snapshot of the counters kept by the allocation functions above */
+typedef struct {
+    size_t allocate_cnt;
+    size_t allocate_bytes;
+    size_t free_cnt;
+    size_t free_bytes;
+    size_t peak_bytes;
+    size_t current_bytes;
+} mem_usage_t;
+
+void get_mem_usage(mem_usage_t *usage);
+
 /* Time counted as fp number in seconds */
 void init_time(double *timep);
 
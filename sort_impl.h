@@ -0,0 +1,364 @@
+/* Sort kernels specialised for one comparison, see queue.c.
+ *
+ * Include with SORT_NAME set to a suffix for the generated functions and
+ * SORT_CMP(a, b) set to a comparison of two list nodes, returning a value
+ * less than, equal to, or greater than zero.  Both are undefined again at
+ * the end, so the file can be included once per comparison.  Inlining the
+ * comparison keeps the direction test out of the inner loops.
+ *
+ * When a node becomes the head of a run being scanned or merged, the node
+ * after it is prefetched, to overlap the two cache misses.  Its string is
+ * not: the prefix key settles most comparisons without it.
+ */
+
+#if !defined(SORT_NAME) || !defined(SORT_CMP)
+#error "SORT_NAME and SORT_CMP must be defined before including sort_impl.h"
+#endif
+
+#define SORT_CONCAT_(x, y) x##_##y
+#define SORT_CONCAT(x, y) SORT_CONCAT_(x, y)
+#define SORT_FN(x) SORT_CONCAT(x, SORT_NAME)
+
+/* Cut the next run off *list.  A run shorter than MIN_RUN is extended by
+ * insertion, as long as input remains.
+ */
+static void SORT_FN(next_run)(struct list_head **list, run_t *run)
+{
+    struct list_head *head = *list, *tail = head, *rest = head->next;
+    size_t len = 1;
+
+    if (rest && SORT_CMP(rest, head) < 0) {
+        /* Descending: reverse while scanning.  To stay stable, a node equal
+         * to the group of equal nodes at the front is appended to that
+         * group instead of being pushed in front of it.
+         */
+        struct list_head *group_tail = head;
+        tail->next = NULL;
+        do {
+            struct list_head *next = rest->next;
+            if (SORT_CMP(rest, head) < 0) {
+                head->prev = rest;
+                rest->next = head;
+                head = rest;
+                group_tail = rest;
+            } else {
+                rest->prev = group_tail;
+                rest->next = group_tail->next;
+                if (group_tail->next)
+                    group_tail->next->prev = rest;
+                else
+                    tail = rest;
+                group_tail->next = rest;
+                group_tail = rest;
+            }
+            rest = next;
+            len++;
+        } while (rest && SORT_CMP(rest, head) <= 0);
+    } else {
+        /* prev links are already right within an ascending stretch */
+        while (rest && SORT_CMP(rest, tail) >= 0) {
+            list_prefetch(rest->next);
+            tail = rest;
+            rest = rest->next;
+            len++;
+        }
+        tail->next = NULL;
+    }
+
+    /* Insert each node after all nodes that compare equal to it */
+    while (rest && len < MIN_RUN) {
+        struct list_head *node = rest, *pos = head, *before = NULL;
+        rest = rest->next;
+        while (pos && SORT_CMP(node, pos) >= 0) {
+            before = pos;
+            pos = pos->next;
+        }
+        node->next = pos;
+        node->prev = before;
+        if (before)
+            before->next = node;
+        else
+            head = node;
+        if (pos)
+            pos->prev = node;
+        else
+            tail = node;
+        len++;
+    }
+
+    *list = rest;
+    run->head = head;
+    run->tail = tail;
+    run->len = len;
+}
+
+/* Count the leading nodes of list (len nodes) that go before key: those
+ * comparing <= key, or < key if strict.  *lastp is set to the last of them.
+ * Probes are made at exponentially growing offsets and the final interval
+ * is bisected, so a streak of k nodes costs O(log k) comparisons.
+ */
+static size_t SORT_FN(gallop)(struct list_head *list,
+                              size_t len,
+                              const struct list_head *key,
+                              bool strict,
+                              struct list_head **lastp)
+{
+#define BEFORE_KEY(node) \
+    (strict ? SORT_CMP(node, key) < 0 : SORT_CMP(node, key) <= 0)
+    struct list_head *last = NULL, *probe = list;
+    size_t lo = 0, hi = len, idx = 0;
+
+    /* Invariant: the first lo nodes go before key, last is node lo - 1,
+     * probe is node idx, and node hi (if any) does not go before key.
+     */
+    for (size_t ofs = 1;; ofs = ofs * 2 + 1) {
+        size_t target = ofs - 1 < len ? ofs - 1 : len - 1;
+        while (idx < target) {
+            probe = probe->next;
+            idx++;
+        }
+        if (!BEFORE_KEY(probe)) {
+            hi = idx;
+            break;
+        }
+        lo = idx + 1;
+        last = probe;
+        if (lo == len)
+            break;
+    }
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        probe = last ? last : list;
+        for (idx = last ? lo - 1 : 0; idx < mid; idx++)
+            probe = probe->next;
+        if (BEFORE_KEY(probe)) {
+            lo = mid + 1;
+            last = probe;
+        } else {
+            hi = mid;
+        }
+    }
+#undef BEFORE_KEY
+
+    *lastp = last;
+    return lo;
+}
+
+/* Stable merge of run a followed by run b.  For the final merge, list is
+ * the queue head: prev links are set along the way and the result is
+ * closed into the circular list.
+ */
+static struct list_head *SORT_FN(merge_runs)(sort_state_t *st,
+                                             struct list_head *a,
+                                             size_t na,
+                                             struct list_head *b,
+                                             size_t nb,
+                                             struct list_head *list)
+{
+    struct list_head *head = NULL, **tail = &head, *last, *prev = list;
+    size_t min_gallop = st->min_gallop;
+
+/* Append the nodes from first to last (inclusive) */
+#define APPEND(first, last)                                    \
+    do {                                                       \
+        *tail = first;                                         \
+        tail = &(last)->next;                                  \
+        for (struct list_head *n = first; list; n = n->next) { \
+            n->prev = prev;                                    \
+            prev = n;                                          \
+            if (n == (last))                                   \
+                break;                                         \
+        }                                                      \
+    } while (0)
+
+    for (;;) {
+        size_t wins_a = 0, wins_b = 0;
+
+        /* One node at a time until a side wins min_gallop times in a row.
+         * If equal, take 'a' -- important for sort stability.
+         */
+        do {
+            if (SORT_CMP(b, a) < 0) {
+                *tail = b;
+                tail = &b->next;
+                if (list) {
+                    b->prev = prev;
+                    prev = b;
+                }
+                b = b->next;
+                if (!--nb)
+                    goto done;
+                list_prefetch(b->next);
+                wins_b++;
+                wins_a = 0;
+            } else {
+                *tail = a;
+                tail = &a->next;
+                if (list) {
+                    a->prev = prev;
+                    prev = a;
+                }
+                a = a->next;
+                if (!--na)
+                    goto done;
+                list_prefetch(a->next);
+                wins_a++;
+                wins_b = 0;
+            }
+        } while ((wins_a | wins_b) < min_gallop);
+
+        /* Gallop while it keeps paying off */
+        size_t k;
+        do {
+            if (min_gallop > 1)
+                min_gallop--;
+
+            k = SORT_FN(gallop)(a, na, b, false, &last);
+            if (k) {
+                struct list_head *first = a;
+                a = last->next;
+                APPEND(first, last);
+                na -= k;
+                if (!na)
+                    goto done;
+            }
+
+            /* Head of a is now greater than head of b */
+            size_t kb = SORT_FN(gallop)(b, nb, a, true, &last);
+            struct list_head *first = b;
+            b = last->next;
+            APPEND(first, last);
+            nb -= kb;
+            if (!nb)
+                goto done;
+
+            if (kb > k)
+                k = kb;
+        } while (k >= MIN_GALLOP);
+        min_gallop += 2;
+    }
+#undef APPEND
+
+done:
+    st->min_gallop = min_gallop;
+    *tail = na ? a : b;
+    if (list) {
+        /* Finish linking the remainder, and close the circle */
+        for (struct list_head *n = *tail; n; n = n->next) {
+            n->prev = prev;
+            prev = n;
+        }
+        prev->next = list;
+        list->prev = prev;
+        list->next = head;
+    }
+    return head;
+}
+
+static void SORT_FN(merge_at)(sort_state_t *st,
+                              int i,
+                              struct list_head *list)
+{
+    run_t *x = &st->runs[i], *y = &st->runs[i + 1];
+    x->head = SORT_FN(merge_runs)(st, x->head, x->len, y->head, y->len, list);
+    x->len += y->len;
+    if (i + 2 < st->n)
+        st->runs[i + 1] = st->runs[i + 2];
+    st->n--;
+}
+
+/* Restore the stack invariants, with the correction by de Gouw et al. that
+ * also checks the run below the top three
+ */
+static void SORT_FN(merge_collapse)(sort_state_t *st)
+{
+    while (st->n > 1) {
+        int n = st->n - 2;
+        run_t *r = st->runs;
+        if ((n > 0 && r[n - 1].len <= r[n].len + r[n + 1].len) ||
+            (n > 1 && r[n - 2].len <= r[n - 1].len + r[n].len)) {
+            if (r[n - 1].len < r[n + 1].len)
+                n--;
+        } else if (r[n].len > r[n + 1].len) {
+            break;
+        }
+        SORT_FN(merge_at)(st, n, NULL);
+    }
+}
+
+/* Merge what is left on the stack; the last merge relinks into head */
+static void SORT_FN(merge_force_collapse)(sort_state_t *st,
+                                          struct list_head *head)
+{
+    while (st->n > 1) {
+        int n = st->n - 2;
+        if (n > 0 && st->runs[n - 1].len < st->runs[n + 1].len)
+            n--;
+        SORT_FN(merge_at)(st, n, st->n == 2 ? head : NULL);
+    }
+}
+
+static void SORT_FN(list_sort)(struct list_head *head)
+{
+    struct list_head *list = head->next;
+
+    if (list == head->prev) /* Zero or one elements */
+        return;
+
+    head->prev->next = NULL;
+
+    /* Scanning runs and the merges it triggers, then the pending merges */
+    uint64_t span = timeline_begin();
+    sort_state_t st = {.n = 0, .min_gallop = MIN_GALLOP};
+    for (;;) {
+        SORT_FN(next_run)(&list, &st.runs[st.n++]);
+        if (!list)
+            break;
+        SORT_FN(merge_collapse)(&st);
+    }
+    timeline_end("sort_runs", span);
+
+    if (st.n == 1) {
+        /* Input was a single run: only its ends need relinking */
+        run_t *run = &st.runs[0];
+        head->next = run->head;
+        run->head->prev = head;
+        head->prev = run->tail;
+        run->tail->next = head;
+        return;
+    }
+    span = timeline_begin();
+    SORT_FN(merge_force_collapse)(&st, head);
+    timeline_end("merge_final", span);
+}
+
+/* Merge the sorted circular list right into left, leaving right empty */
+static void SORT_FN(merge_lists)(struct list_head *left,
+                                 struct list_head *right)
+{
+    if (list_empty(right))
+        return;
+    if (list_empty(left)) {
+        list_splice_init(right, left);
+        return;
+    }
+
+    LIST_HEAD(result);
+    while (!list_empty(left) && !list_empty(right)) {
+        /* If equal, take from left -- important for stability */
+        if (SORT_CMP(right->next, left->next) < 0)
+            list_move_tail(right->next, &result);
+        else
+            list_move_tail(left->next, &result);
+    }
+    list_splice_tail_init(left, &result);
+    list_splice_tail_init(right, &result);
+    list_splice(&result, left);
+}
+
+#undef SORT_FN
+#undef SORT_CONCAT
+#undef SORT_CONCAT_
+#undef SORT_CMP
+#undef SORT_NAME
@@ -0,0 +1,146 @@
+/* Per-thread span recording and Chrome trace_event export */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timeline.h"
+
+typedef struct {
+    const char *name;
+    uint64_t start, end;
+} span_t;
+
+typedef struct __timeline_ring {
+    span_t spans[TIMELINE_RING];
+    uint64_t head;    /* Spans ever recorded, published by the owner */
+    const char *name; /* Track name */
+    int tid;
+    struct __timeline_ring *next;
+} timeline_ring_t;
+
+bool timeline_on = false;
+
+/* Rings are never freed: a thread that exits leaves its spans behind */
+static timeline_ring_t *rings = NULL;
+static int next_tid = 1;
+static __thread timeline_ring_t *ring = NULL;
+
+/* Time zero of the exported timeline */
+static uint64_t origin;
+
+uint64_t timeline_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000UL + (uint64_t) ts.tv_nsec;
+}
+
+static timeline_ring_t *ring_get(void)
+{
+    if (ring)
+        return ring;
+
+    timeline_ring_t *r = calloc(1, sizeof(timeline_ring_t));
+    if (!r)
+        return NULL;
+    r->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    ring = r;
+    return r;
+}
+
+void timeline_span(const char *name, uint64_t start, uint64_t end)
+{
+    timeline_ring_t *r = ring_get();
+    if (!r)
+        return;
+    span_t *s = &r->spans[r->head & (TIMELINE_RING - 1)];
+    s->name = name;
+    s->start = start;
+    s->end = end;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+void timeline_thread_name(const char *name)
+{
+    timeline_ring_t *r = ring_get();
+    if (r)
+        r->name = name;
+}
+
+/* Only the owner of a ring writes its head, so earlier spans are not cleared
+ * but left out of the export by their start time
+ */
+void timeline_start(void)
+{
+    origin = timeline_now();
+    __atomic_store_n(&timeline_on, true, __ATOMIC_RELEASE);
+}
+
+static void write_name(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char) *s >= ' ')
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* The owner may be recording while its ring is read.  A span is kept only if
+ * the owner had not started to reuse its slot by the time it was copied, and
+ * if it started after the timeline did.
+ */
+static void write_ring(FILE *out, timeline_ring_t *r, bool *first)
+{
+    if (r->name) {
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                     "\"tid\":%d,\"args\":{\"name\":",
+                *first ? "" : ",", r->tid);
+        write_name(out, r->name);
+        fputs("}}", out);
+        *first = false;
+    }
+
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t lo = head > TIMELINE_RING ? head - TIMELINE_RING : 0;
+    for (uint64_t i = lo; i < head; i++) {
+        span_t s = r->spans[i & (TIMELINE_RING - 1)];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (i + TIMELINE_RING <= __atomic_load_n(&r->head, __ATOMIC_RELAXED))
+            continue;
+        if (s.start < origin)
+            continue;
+        fprintf(out, "%s\n{\"name\":", *first ? "" : ",");
+        write_name(out, s.name);
+        fprintf(out,
+                ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                "\"dur\":%.3f}",
+                r->tid, (s.start - origin) * 1e-3, (s.end - s.start) * 1e-3);
+        *first = false;
+    }
+}
+
+bool timeline_stop(const char *file)
+{
+    __atomic_store_n(&timeline_on, false, __ATOMIC_RELEASE);
+
+    FILE *out = fopen(file, "w");
+    if (!out)
+        return false;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    bool first = true;
+    for (timeline_ring_t *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r;
+         r = r->next)
+        write_ring(out, r, &first);
+    fputs("\n]}\n", out);
+
+    bool ok = !ferror(out);
+    return !fclose(out) && ok;
+}
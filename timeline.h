@@ -0,0 +1,64 @@
+#ifndef LAB0_TIMELINE_H
+#define LAB0_TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Span timeline, written in the Chrome trace_event JSON format for viewing
+ * in Perfetto or chrome://tracing.
+ *
+ * Each thread records complete spans into a ring buffer of its own, which
+ * only that thread writes; a full ring overwrites its oldest spans.  While
+ * the timeline is off, a span costs a load and a branch.
+ */
+
+/* Spans kept per thread */
+#define TIMELINE_RING (1 << 16)
+
+extern bool timeline_on;
+
+/* Monotonic time in nanoseconds */
+uint64_t timeline_now(void);
+
+/* Record the span name from start until end.  name must outlive the
+ * timeline, in practice a string literal.
+ */
+void timeline_span(const char *name, uint64_t start, uint64_t end);
+
+/* Start time of a span, 0 if the timeline is off */
+static inline uint64_t timeline_begin(void)
+{
+    return __atomic_load_n(&timeline_on, __ATOMIC_RELAXED) ? timeline_now()
+                                                           : 0;
+}
+
+/* End a span started by timeline_begin() */
+static inline void timeline_end(const char *name, uint64_t start)
+{
+    if (start)
+        timeline_span(name, start, timeline_now());
+}
+
+/* Record a span whose ends the caller has already read from the monotonic
+ * clock, for code that times itself anyway
+ */
+static inline void timeline_end_at(const char *name,
+                                   uint64_t start,
+                                   uint64_t end)
+{
+    if (__atomic_load_n(&timeline_on, __ATOMIC_RELAXED))
+        timeline_span(name, start, end);
+}
+
+/* Name the calling thread's track, e.g. "main" */
+void timeline_thread_name(const char *name);
+
+/* Discard recorded spans and start recording */
+void timeline_start(void);
+
+/* Stop recording and write the spans to file.
+ * Return: false if the file could not be written
+ */
+bool timeline_stop(const char *file);
+
+#endif /* LAB0_TIMELINE_H */
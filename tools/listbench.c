@@ -0,0 +1,208 @@
+/* Queue traversal and sort benchmark on queues larger than the last-level
+ * cache.  Build with "make bench", which runs it once with software
+ * prefetching and once without (LIST_PREFETCH_DISTANCE=0).
+ *
+ * Nodes are shuffled after insertion so that list order and address order
+ * are unrelated, as in a long-lived queue; otherwise the hardware prefetcher
+ * hides most of the misses.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "queue.h"
+#include "random.h"
+
+#define DEFAULT_SIZE (2 * 1024 * 1024)
+#define DEFAULT_REPS 3
+#define MIN_LEN 5
+#define MAX_LEN 24
+
+/* queue.c is built with INTERNAL, so only q_release_element() needs these */
+void *test_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *test_calloc(size_t nelem, size_t elsize)
+{
+    return calloc(nelem, elsize);
+}
+
+void test_free(void *p)
+{
+    free(p);
+}
+
+char *test_strdup(const char *s)
+{
+    return strdup(s);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Fixed seed: both builds must see the same queue */
+static prng_t prng = {{0x9e3779b97f4a7c15, 0xbf58476d1ce4e5b9,
+                       0x94d049bb133111eb, 0x2545f4914f6cdd1d}};
+
+static struct list_head *fill(size_t n)
+{
+    struct list_head *q = q_new();
+    char buf[MAX_LEN + 1];
+    for (size_t i = 0; q && i < n; i++) {
+        size_t len = MIN_LEN + prng_bounded(&prng, MAX_LEN - MIN_LEN + 1);
+        for (size_t j = 0; j < len; j++)
+            buf[j] = 'a' + prng_bounded(&prng, 26);
+        if (!q_insert_tail_n(q, buf, len)) {
+            q_free(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+/* Relink the nodes in random order, leaving their addresses alone */
+static bool shuffle(struct list_head *head, size_t n)
+{
+    struct list_head **nodes = malloc(n * sizeof(*nodes));
+    if (!nodes)
+        return false;
+
+    struct list_head *node;
+    size_t i = 0;
+    list_for_each(node, head)
+        nodes[i++] = node;
+    for (i = n - 1; i > 0; i--) {
+        size_t j = prng_bounded(&prng, i + 1);
+        struct list_head *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+
+    INIT_LIST_HEAD(head);
+    for (i = 0; i < n; i++)
+        list_add_tail(nodes[i], head);
+    free(nodes);
+    q_resync(head);
+    return true;
+}
+
+/* Touch every node and its string, the access pattern of "show" */
+static size_t walk(struct list_head *head)
+{
+    size_t sum = 0;
+    element_t *e;
+    list_for_each_entry(e, head, list)
+        sum += (unsigned char) e->value[e->len - 1];
+    return sum;
+}
+
+static size_t walk_prefetch(struct list_head *head)
+{
+    size_t sum = 0;
+    element_t *e;
+    struct list_head *ahead;
+    list_for_each_entry_prefetch(e, ahead, head, list) {
+        if (ahead != head)
+            list_prefetch(list_entry(ahead, element_t, list)->value);
+        sum += (unsigned char) e->value[e->len - 1];
+    }
+    return sum;
+}
+
+static void report(const char *what, double *t, int reps)
+{
+    double best = t[0];
+    for (int i = 1; i < reps; i++) {
+        if (t[i] < best)
+            best = t[i];
+    }
+    printf("  %-18s %8.1f ms\n", what, best * 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = DEFAULT_SIZE;
+    int reps = DEFAULT_REPS;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:r:")) != -1) {
+        switch (c) {
+        case 'n':
+            n = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        default:
+            printf("Usage: %s [-n elements] [-r repetitions]\n", argv[0]);
+            return c != 'h';
+        }
+    }
+    if (n < 2 || reps < 1 || reps > 100) {
+        fprintf(stderr, "Need at least 2 elements and 1 to 100 repetitions\n");
+        return 1;
+    }
+
+    printf("%zu elements, prefetch distance %d, best of %d\n", n,
+           LIST_PREFETCH_DISTANCE, reps);
+
+    double t_walk[100], t_walk_pf[100], t_sort[100], t_sorted[100],
+        t_desc[100], t_free[100];
+    size_t check = 0;
+    for (int r = 0; r < reps; r++) {
+        struct list_head *q = fill(n);
+        if (!q || !shuffle(q, n)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+
+        double t = now();
+        check += walk(q);
+        t_walk[r] = now() - t;
+
+        t = now();
+        check -= walk_prefetch(q);
+        t_walk_pf[r] = now() - t;
+
+        t = now();
+        q_sort(q, false);
+        t_sort[r] = now() - t;
+
+        /* Sorted input is a single run, found by one scan */
+        t = now();
+        q_sort(q, false);
+        t_sorted[r] = now() - t;
+
+        t = now();
+        q_sort(q, true);
+        t_desc[r] = now() - t;
+
+        t = now();
+        q_free(q);
+        t_free[r] = now() - t;
+    }
+
+    if (check) {
+        fprintf(stderr, "Traversals disagree\n");
+        return 1;
+    }
+
+    report("walk", t_walk, reps);
+    report("walk, prefetching", t_walk_pf, reps);
+    report("sort, shuffled", t_sort, reps);
+    report("sort, sorted", t_sorted, reps);
+    report("sort, reversed", t_desc, reps);
+    report("free", t_free, reps);
+    return 0;
+}
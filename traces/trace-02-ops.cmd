@@ -18,3 +18,27 @@ rh bear
 rh bear
 rh gerbil
 rh meerkat
+ih e
+ih d
+ih c
+ih b
+ih a
+dm
+dm
+rh a
+dm
+it f
+it g
+it h
+rt h
+dm
+it i
+it j
+rh e
+rh g
+it k
+it l
+dm
+rh i
+dm
+rh l
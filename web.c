@@ -11,6 +11,8 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "web.h"
+
 #define LISTENQ 1024 /* second argument to listen() */
 #define MAXLINE 1024 /* max length of a line */
 #define BUFSIZE 1024
@@ -24,6 +26,7 @@
 #endif
 
 static int server_fd;
+static web_metrics_func_t metrics_func = NULL;
 
 typedef struct {
     int fd;            /* descriptor for this buf */
@@ -234,22 +237,30 @@ char *web_recv(int fd, struct sockaddr_in *clientaddr)
     return ret;
 }
 
+void web_set_metrics(web_metrics_func_t fn)
+{
+    metrics_func = fn;
+}
+
 int web_eventmux(char *buf)
 {
     fd_set listenset;
 
-    FD_ZERO(&listenset);
-    FD_SET(STDIN_FILENO, &listenset);
-    int max_fd = STDIN_FILENO;
-    if (server_fd > 0) {
-        FD_SET(server_fd, &listenset);
-        max_fd = max_fd > server_fd ? max_fd : server_fd;
-    }
-    int result = select(max_fd + 1, &listenset, NULL, NULL, NULL);
-    if (result < 0)
-        return -1;
+    for (;;) {
+        FD_ZERO(&listenset);
+        FD_SET(STDIN_FILENO, &listenset);
+        int max_fd = STDIN_FILENO;
+        if (server_fd > 0) {
+            FD_SET(server_fd, &listenset);
+            max_fd = max_fd > server_fd ? max_fd : server_fd;
+        }
+        int result = select(max_fd + 1, &listenset, NULL, NULL, NULL);
+        if (result < 0)
+            return -1;
+
+        if (!(server_fd > 0 && FD_ISSET(server_fd, &listenset)))
+            break;
 
-    if (server_fd > 0 && FD_ISSET(server_fd, &listenset)) {
         FD_CLR(server_fd, &listenset);
         struct sockaddr_in clientaddr;
         socklen_t clientlen = sizeof(clientaddr);
@@ -257,6 +268,20 @@ int web_eventmux(char *buf)
             accept(server_fd, (struct sockaddr *) &clientaddr, &clientlen);
 
         char *p = web_recv(web_connfd, &clientaddr);
+
+        /* Scrapes are answered here and never reach the interpreter, so keep
+         * waiting for a command afterwards.
+         */
+        if (metrics_func && !strcmp(p, "metrics")) {
+            web_send(web_connfd,
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n\r\n");
+            metrics_func(web_connfd);
+            free(p);
+            close(web_connfd);
+            continue;
+        }
+
         char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
         web_send(web_connfd, buffer);
         strncpy(buf, p, strlen(p) + 1);
@@ -11,4 +11,9 @@ void web_send(int out_fd, char *buffer);
 
 int web_eventmux(char *buf);
 
+/* Handler writing the body of a GET /metrics response to fd */
+typedef void (*web_metrics_func_t)(int fd);
+
+void web_set_metrics(web_metrics_func_t fn);
+
 #endif
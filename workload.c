@@ -0,0 +1,281 @@
+/* Synthetic workload generator */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The key table is private; keep it out of the allocation checks.  Queue
+ * elements are still released through the harness by q_release_element().
+ */
+#define INTERNAL 1
+#include "harness.h"
+
+#include "metrics.h"
+#include "queue.h"
+#include "random.h"
+#include "workload.h"
+
+static const char *const op_names[] = {
+#define _(x) #x,
+    WL_OPS
+#undef _
+};
+
+static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+const char *wl_op_name(int op)
+{
+    return op >= 0 && op < WL_NOPS ? op_names[op] : "?";
+}
+
+void wl_defaults(wl_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->ops = 1000000;
+    cfg->weight[WL_ih] = cfg->weight[WL_it] = 1;
+    cfg->weight[WL_rh] = cfg->weight[WL_rt] = 1;
+    cfg->universe = 1 << 16;
+    cfg->min_len = 8;
+    cfg->max_len = 64;
+    cfg->seed = 1;
+}
+
+/* Parse an unsigned integer, allowing exponent notation such as 1e7 */
+static bool parse_count(const char *s, char **end, uint64_t *v)
+{
+    double d = strtod(s, end);
+    if (*end == s || !(d >= 0) || d > 1e15 || d != floor(d))
+        return false;
+    *v = (uint64_t) d;
+    return true;
+}
+
+static bool parse_mix(wl_config_t *cfg, const char *s)
+{
+    uint32_t weight[WL_NOPS] = {0};
+    uint64_t total = 0;
+    while (*s) {
+        const char *colon = strchr(s, ':');
+        if (!colon)
+            return false;
+        int op = 0;
+        while (op < WL_NOPS && (strlen(op_names[op]) != (size_t) (colon - s) ||
+                                strncmp(op_names[op], s, colon - s)))
+            op++;
+        uint64_t w;
+        char *end;
+        if (op == WL_NOPS || !parse_count(colon + 1, &end, &w) ||
+            (*end && *end != ',') || w > UINT32_MAX)
+            return false;
+        weight[op] = w;
+        total += w;
+        s = *end ? end + 1 : end;
+    }
+    if (!total || total > UINT32_MAX)
+        return false;
+    memcpy(cfg->weight, weight, sizeof(weight));
+    return true;
+}
+
+bool wl_parse(wl_config_t *cfg, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    if (!eq)
+        return false;
+    size_t klen = eq - arg;
+    const char *val = eq + 1;
+    char *end;
+    uint64_t v;
+
+#define KEY(k) (klen == sizeof(k) - 1 && !strncmp(arg, k, klen))
+    if (KEY("ops"))
+        return parse_count(val, &end, &cfg->ops) && !*end && cfg->ops;
+    if (KEY("mix"))
+        return parse_mix(cfg, val);
+    if (KEY("keys")) {
+        if (!strcmp(val, "uniform")) {
+            cfg->zipf = 0;
+            return true;
+        }
+        if (strncmp(val, "zipf:", 5))
+            return false;
+        double s = strtod(val + 5, &end);
+        if (end == val + 5 || *end || !(s > 0) || s > 100)
+            return false;
+        cfg->zipf = s;
+        return true;
+    }
+    if (KEY("universe")) {
+        if (!parse_count(val, &end, &v) || *end || !v || v > WL_MAX_UNIVERSE)
+            return false;
+        cfg->universe = v;
+        return true;
+    }
+    if (KEY("len")) {
+        /* strtod() would take the first dot of "8..64" as a decimal point */
+        unsigned long lo = strtoul(val, &end, 10), hi = lo;
+        if (end == val)
+            return false;
+        if (!strncmp(end, "..", 2)) {
+            const char *s = end + 2;
+            hi = strtoul(s, &end, 10);
+            if (end == s)
+                return false;
+        }
+        if (*end || !lo || lo > hi || hi > WL_MAX_LEN)
+            return false;
+        cfg->min_len = lo;
+        cfg->max_len = hi;
+        return true;
+    }
+    if (KEY("seed")) {
+        cfg->seed = strtoull(val, &end, 0);
+        return end != val && !*end;
+    }
+#undef KEY
+    return false;
+}
+
+/* The distinct keys, stored back to back, and the cumulative distribution
+ * of their popularity for Zipf workloads
+ */
+typedef struct {
+    char *chars;
+    size_t *offset; /* Key i is chars[offset[i]..offset[i + 1] - 1) */
+    double *cdf;
+} keys_t;
+
+static void keys_free(keys_t *k)
+{
+    free(k->chars);
+    free(k->offset);
+    free(k->cdf);
+}
+
+static bool keys_build(keys_t *k, const wl_config_t *cfg, prng_t *p)
+{
+    uint32_t n = cfg->universe;
+    uint32_t span = cfg->max_len - cfg->min_len + 1;
+    memset(k, 0, sizeof(*k));
+    k->offset = malloc((n + 1) * sizeof(size_t));
+    k->chars = malloc((size_t) n * (cfg->max_len + 1));
+    if (cfg->zipf > 0)
+        k->cdf = malloc(n * sizeof(double));
+    if (!k->offset || !k->chars || (cfg->zipf > 0 && !k->cdf)) {
+        keys_free(k);
+        return false;
+    }
+
+    /* Each key keeps its terminator, which prng_fill_string() writes */
+    size_t pos = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        size_t len = cfg->min_len + prng_bounded(p, span);
+        k->offset[i] = pos;
+        prng_fill_string(p, k->chars + pos, len, charset, sizeof(charset) - 1);
+        pos += len + 1;
+    }
+    k->offset[n] = pos;
+
+    if (k->cdf) {
+        double sum = 0;
+        for (uint32_t i = 0; i < n; i++)
+            k->cdf[i] = sum += pow(i + 1, -cfg->zipf);
+        for (uint32_t i = 0; i < n; i++)
+            k->cdf[i] /= sum;
+    }
+    return true;
+}
+
+/* Index of the key of a random rank */
+static uint32_t keys_pick(const keys_t *k, uint32_t n, prng_t *p)
+{
+    if (!k->cdf)
+        return prng_bounded(p, n);
+
+    double u = (prng_next(p) >> 11) * 0x1p-53;
+    uint32_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (k->cdf[mid] <= u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool wl_run(const wl_config_t *cfg, struct list_head *q, wl_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+
+    prng_t p;
+    prng_seed_u64(&p, cfg->seed);
+    keys_t keys;
+    if (!keys_build(&keys, cfg, &p))
+        return false;
+
+    uint32_t cum[WL_NOPS], total = 0;
+    for (int i = 0; i < WL_NOPS; i++)
+        cum[i] = total += cfg->weight[i];
+
+    char buf[WL_MAX_LEN + 1];
+    uint64_t start = metrics_now_ns();
+    for (uint64_t n = 0; n < cfg->ops; n++) {
+        uint32_t r = prng_bounded(&p, total);
+        int op = 0;
+        while (cum[op] <= r)
+            op++;
+        res->count[op]++;
+
+        element_t *e;
+        switch (op) {
+        case WL_ih:
+        case WL_it: {
+            uint32_t i = keys_pick(&keys, cfg->universe, &p);
+            const char *s = keys.chars + keys.offset[i];
+            size_t len = keys.offset[i + 1] - keys.offset[i] - 1;
+            bool ok = op == WL_ih ? q_insert_head_n(q, s, len)
+                                  : q_insert_tail_n(q, s, len);
+            res->failed += !ok;
+            break;
+        }
+        case WL_rh:
+        case WL_rt:
+            e = op == WL_rh ? q_remove_head(q, buf, sizeof(buf))
+                            : q_remove_tail(q, buf, sizeof(buf));
+            if (e)
+                q_release_element(e);
+            else
+                res->empty++;
+            break;
+        case WL_dm:
+            res->empty += !q_delete_mid(q);
+            break;
+        case WL_size:
+            q_size(q);
+            break;
+        case WL_sort:
+            q_sort(q, false);
+            break;
+        case WL_reverse:
+            q_reverse(q);
+            break;
+        case WL_swap:
+            q_swap(q);
+            break;
+        case WL_dedup:
+            q_delete_dup(q);
+            break;
+        case WL_ascend:
+            q_ascend(q);
+            break;
+        case WL_descend:
+            q_descend(q);
+            break;
+        }
+    }
+    res->ns = metrics_now_ns() - start;
+
+    keys_free(&keys);
+    return true;
+}
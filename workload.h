@@ -0,0 +1,80 @@
+#ifndef LAB0_WORKLOAD_H
+#define LAB0_WORKLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/* Synthetic workloads for the queue API.
+ *
+ * Operations are drawn from a weighted mix and applied straight to a queue,
+ * with no command parsing in between.  Inserted strings come from a fixed
+ * table of distinct keys, picked uniformly or by a Zipf distribution over
+ * their popularity rank.  Everything is derived from one seed, so a
+ * workload is reproducible from its description alone.
+ */
+
+/* Longest key */
+#define WL_MAX_LEN 1024
+
+/* Largest key table */
+#define WL_MAX_UNIVERSE (1 << 24)
+
+#define WL_OPS \
+    _(ih)      \
+    _(it)      \
+    _(rh)      \
+    _(rt)      \
+    _(dm)      \
+    _(size)    \
+    _(sort)    \
+    _(reverse) \
+    _(swap)    \
+    _(dedup)   \
+    _(ascend)  \
+    _(descend)
+
+enum {
+#define _(x) WL_##x,
+    WL_OPS
+#undef _
+        WL_NOPS
+};
+
+typedef struct {
+    uint64_t ops;             /* Number of operations */
+    uint32_t weight[WL_NOPS]; /* Relative frequency of each operation */
+    double zipf;              /* Zipf exponent, 0 for uniform keys */
+    uint32_t universe;        /* Number of distinct keys */
+    uint32_t min_len, max_len;
+    uint64_t seed;
+} wl_config_t;
+
+typedef struct {
+    uint64_t count[WL_NOPS]; /* Operations issued */
+    uint64_t empty;          /* Removals and dm on an empty queue */
+    uint64_t failed;         /* Insertions that failed */
+    uint64_t ns;             /* Time spent in the operations */
+} wl_result_t;
+
+/* Name of operation op, as in the mix */
+const char *wl_op_name(int op);
+
+/* Default workload: 1e6 insertions and removals at both ends, of uniformly
+ * picked keys of 8 to 64 letters
+ */
+void wl_defaults(wl_config_t *cfg);
+
+/* Apply one "key=value" setting: ops=N, mix=op:weight[,op:weight...],
+ * keys=uniform|zipf:S, universe=N, len=MIN[..MAX] or seed=N.
+ * Return: false if arg is malformed or out of range
+ */
+bool wl_parse(wl_config_t *cfg, const char *arg);
+
+/* Run the workload on q.
+ * Return: false if the key table could not be allocated
+ */
+bool wl_run(const wl_config_t *cfg, struct list_head *q, wl_result_t *res);
+
+#endif /* LAB0_WORKLOAD_H */